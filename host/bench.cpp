@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+// bench.h on the host, against a checked-in baseline file of the same JSON
+// lines it prints. Exits non-zero if any result regressed.
+//
+//   bench [--baseline FILE] [--tolerance PERCENT] [--rebaseline]
+//
+// --rebaseline rewrites the file with this run's timings; otherwise it is
+// only read. A fixed calibration loop is timed with every run and kept with
+// the baseline, and baselines are scaled by how much faster or slower it ran
+// this time, so a slower or throttled machine does not read as a regression.
+
+#define BASELINE_MAX 32
+
+struct Baseline
+{
+  char name[32];
+  uint32_t ns;
+};
+
+static Baseline baselines[BASELINE_MAX];
+static int baselineCount = 0;
+static bool baselineChanged = false;
+// Calibration now and when the baseline was recorded
+static uint32_t calibrationNs = 0;
+static uint32_t calibrationBaselineNs = 0;
+
+static Baseline *baselineFind(const char *name)
+{
+  for (int i = 0; i < baselineCount; i++)
+  {
+    if (strcmp(baselines[i].name, name) == 0)
+      return &baselines[i];
+  }
+  return nullptr;
+}
+
+static bool baselineLoad(const char *name, uint32_t &ns)
+{
+  Baseline *b = baselineFind(name);
+  if (b == nullptr)
+    return false;
+  ns = calibrationBaselineNs ? (uint32_t)((uint64_t)b->ns * calibrationNs / calibrationBaselineNs) : b->ns;
+  return true;
+}
+
+// Table lookups and arithmetic over a few KB, roughly the mix of the benchmarks
+static uint32_t calibrate()
+{
+  static uint8_t table[4096];
+  uint32_t x = 1;
+  auto work = [&]()
+  {
+    for (int i = 0; i < 256; i++)
+    {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      table[x % sizeof(table)] += (uint8_t)__builtin_popcount(x + table[(x >> 12) % sizeof(table)]);
+    }
+  };
+  // The best of a few, spread out like the benchmarks it scales
+  uint32_t ns = UINT32_MAX;
+  for (int i = 0; i < 5; i++)
+  {
+    uint32_t again = benchTime(200, work);
+    ns = again < ns ? again : ns;
+  }
+  if (table[x % sizeof(table)] == 0xFF)
+    ns++; // Keeps the work
+  return ns;
+}
+
+static void baselineSave(const char *name, uint32_t ns)
+{
+  Baseline *b = baselineFind(name);
+  if (b == nullptr && baselineCount < BASELINE_MAX)
+  {
+    b = &baselines[baselineCount++];
+    strncpy(b->name, name, sizeof(b->name) - 1);
+  }
+  if (b)
+  {
+    b->ns = ns;
+    baselineChanged = true;
+  }
+}
+
+static void baselineRead(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  if (f == nullptr)
+    return;
+
+  char line[128];
+  while (fgets(line, sizeof(line), f) && baselineCount < BASELINE_MAX)
+  {
+    Baseline &b = baselines[baselineCount];
+    unsigned long ns;
+    if (sscanf(line, "{\"bench\":\"%31[^\"]\",\"ns\":%lu", b.name, &ns) == 2 && strcmp(b.name, "done") != 0)
+    {
+      b.ns = (uint32_t)ns;
+      baselineCount++;
+    }
+  }
+  fclose(f);
+}
+
+static bool baselineWrite(const char *path)
+{
+  FILE *f = fopen(path, "w");
+  if (f == nullptr)
+    return false;
+  for (int i = 0; i < baselineCount; i++)
+  {
+    fprintf(f, "{\"bench\":\"%s\",\"ns\":%lu}\n", baselines[i].name, (unsigned long)baselines[i].ns);
+  }
+  return fclose(f) == 0;
+}
+
+int main(int argc, char **argv)
+{
+  const char *path = "bench_baseline.jsonl";
+  BenchOptions o = {baselineLoad, baselineSave, false, BENCH_TOLERANCE};
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+      path = argv[++i];
+    else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+      o.tolerance = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--rebaseline") == 0)
+      o.rebaseline = true;
+    else
+    {
+      fprintf(stderr, "usage: %s [--baseline FILE] [--tolerance PERCENT] [--rebaseline]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  baselineRead(path);
+
+  calibrationNs = calibrate();
+  Baseline *calibration = baselineFind("calibration");
+  if (o.rebaseline || calibration == nullptr)
+    baselineSave("calibration", calibrationNs);
+  else
+    calibrationBaselineNs = calibration->ns;
+  printf("{\"bench\":\"calibration\",\"ns\":%lu,\"baseline\":%lu}\n", (unsigned long)calibrationNs,
+         (unsigned long)(calibrationBaselineNs ? calibrationBaselineNs : calibrationNs));
+
+  int failed = benchRun(o);
+
+  if (o.rebaseline && baselineChanged && !baselineWrite(path))
+  {
+    fprintf(stderr, "Could not write %s\n", path);
+    return 2;
+  }
+  return failed ? 1 : 0;
+}
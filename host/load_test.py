@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""Hammers the watch's /api and /reload from several clients at once.
+
+Each client keeps one connection open and sends a mix of single commands,
+batches of up to API_BATCH_MAX, some of them pretty-printed and padded,
+reloads, and requests the handlers must refuse: more commands than
+API_BATCH_MAX and an unknown command. Neither handler waits on the render
+or network task, so every answer should come back quickly; a 503 "UI busy"
+is allowed for /api, as the queue pushing back.
+
+    python3 load_test.py ADDRESS [--clients 4] [--seconds 30] [--max-ms 250]
+
+Prints one JSON line per kind of request and a summary. Fails on a
+connection error, an unexpected status, or a p95 latency over --max-ms.
+
+A manual tool: it needs a watch on the network, so it is not part of the
+host build's ctest.
+"""
+
+import argparse
+import http.client
+import json
+import random
+import sys
+import threading
+import time
+
+# http.h
+API_BATCH_MAX = 256
+
+GESTURES = ["left", "right", "forward", "back"]
+
+
+def command(rng):
+    if rng.random() < 0.5:
+        return {"shift": rng.choice([-1, 1])}
+    return {"gesture": rng.choice(GESTURES)}
+
+
+# A random request: its kind, method, path, body and the statuses it may get
+def request(rng):
+    kind = rng.choices(["single", "batch", "padded", "reload", "too_many", "unknown"], [45, 25, 10, 15, 3, 2])[0]
+    if kind == "single":
+        return kind, "POST", "/api", json.dumps(command(rng)), (200, 503)
+    if kind == "batch":
+        batch = [command(rng) for _ in range(rng.randint(2, API_BATCH_MAX))]
+        return kind, "POST", "/api", json.dumps(batch, separators=(",", ":")), (200, 503)
+    if kind == "padded":
+        # Whitespace costs the parse no memory, a full batch like this must still go through
+        batch = [command(rng) for _ in range(API_BATCH_MAX)]
+        return kind, "POST", "/api", json.dumps(batch, indent=8) + " " * 4096, (200, 503)
+    if kind == "reload":
+        return kind, "GET", "/reload", None, (200,)
+    if kind == "too_many":
+        batch = [command(rng) for _ in range(rng.randint(API_BATCH_MAX + 1, API_BATCH_MAX * 8))]
+        return kind, "POST", "/api", json.dumps(batch), (400,)
+    return kind, "POST", "/api", '{"spin": true}', (400,)
+
+
+class Results:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.latencies = {}
+        self.statuses = {}
+        self.errors = []
+
+    def add(self, kind, status, ms):
+        with self.lock:
+            self.latencies.setdefault(kind, []).append(ms)
+            counts = self.statuses.setdefault(kind, {})
+            counts[status] = counts.get(status, 0) + 1
+
+    def error(self, text):
+        with self.lock:
+            self.errors.append(text)
+
+
+def client(host, port, deadline, seed, results):
+    rng = random.Random(seed)
+    conn = http.client.HTTPConnection(host, port, timeout=10)
+    while time.monotonic() < deadline:
+        kind, method, path, body, accepted = request(rng)
+        headers = {"Content-Type": "application/json"} if body is not None else {}
+        start = time.monotonic()
+        try:
+            conn.request(method, path, body=body, headers=headers)
+            response = conn.getresponse()
+            text = response.read()
+        except (OSError, http.client.HTTPException) as e:
+            results.error("%s %s: %s" % (method, path, e))
+            conn.close()
+            conn = http.client.HTTPConnection(host, port, timeout=10)
+            continue
+        ms = (time.monotonic() - start) * 1000
+        results.add(kind, response.status, ms)
+        if response.status not in accepted:
+            results.error("%s %s (%s): %d %s" % (method, path, kind, response.status, text[:80]))
+        # A server refusing a body may close rather than read the rest of it
+        if kind == "too_many" or response.getheader("Connection", "").lower() == "close":
+            conn.close()
+            conn = http.client.HTTPConnection(host, port, timeout=10)
+    conn.close()
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("address", help="the watch, host or host:port")
+    # httpd's default allows 7 sockets and keeps 3 for itself
+    parser.add_argument("--clients", type=int, default=4)
+    parser.add_argument("--seconds", type=float, default=30)
+    parser.add_argument("--max-ms", type=float, default=250)
+    parser.add_argument("--seed", type=int, default=25)
+    args = parser.parse_args()
+
+    host, _, port = args.address.partition(":")
+    port = int(port or 80)
+    results = Results()
+    deadline = time.monotonic() + args.seconds
+    threads = [threading.Thread(target=client, args=(host, port, deadline, args.seed + i, results))
+               for i in range(args.clients)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    slow = []
+    total = 0
+    for kind, ms in sorted(results.latencies.items()):
+        p95 = percentile(ms, 95)
+        total += len(ms)
+        print(json.dumps({"kind": kind, "requests": len(ms), "statuses": results.statuses[kind],
+                          "ms_p50": round(percentile(ms, 50), 1), "ms_p95": round(p95, 1), "ms_max": round(max(ms), 1)}))
+        if p95 > args.max_ms:
+            slow.append(kind)
+
+    print(json.dumps({"clients": args.clients, "seconds": args.seconds, "requests": total,
+                      "per_second": round(total / args.seconds, 1), "errors": len(results.errors), "slow": slow}))
+    for e in results.errors[:20]:
+        print(e, file=sys.stderr)
+    return 1 if results.errors or slow or total == 0 else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
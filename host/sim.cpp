@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+
+#define PANEL_SIM 1
+
+#include "lvgl/lvgl.h"
+#include "events.h"
+#include "event_list.h"
+#include "gesture.h"
+#include "motion_sim.h"
+#include "panel.h"
+
+// The watch's render loop, faster than real time on the virtual clock. A
+// scripted sensor feeds the recognizer at 100 Hz, gestures move the tiles and
+// the event list, the clock and the once-a-second bar tick, and whatever
+// changed is drawn into a logical I1 screen and flushed through panel.h to
+// the simulated panel. Glyphs are stand-ins, a pattern per character, so a
+// changed character flips about as many pixels as a real one.
+//
+// The panel task's pass runs at once when it is woken, the clock running on
+// through its BUSY waits; the clock is then set back for the render loop,
+// and the task is only woken again once the loop has caught up with the end
+// of the pass.
+//
+//   sim [minutes] [script]
+//
+// Prints one JSON line. Fails if the panel does not end up showing the frame.
+
+#define SCREEN_W 296
+#define SCREEN_H 128
+#define SCREEN_STRIDE (SCREEN_W / 8)
+#define STEP_US 10000
+#define GLYPH_W 6
+#define LINE_SPACING 16
+#define TILES 3
+#define SENSOR_BATCH 16
+
+struct Ui
+{
+  uint8_t screen[SCREEN_STRIDE * SCREEN_H];
+  EventList list;
+  EventStore *events;
+  int cursor;
+  int tile;
+  char clock[32];
+  int bar;
+
+  // Logical areas to redraw, x1 y1 x2 y2
+  int areas[32][4];
+  int areaCount;
+};
+
+static void uiInvalidate(Ui &ui, int x1, int y1, int x2, int y2)
+{
+  // rounder_cb
+  x1 &= ~7;
+  y1 &= ~7;
+  x2 |= 7;
+  y2 |= 7;
+  x2 = x2 < SCREEN_W ? x2 : SCREEN_W - 1;
+  y2 = y2 < SCREEN_H ? y2 : SCREEN_H - 1;
+  if (ui.areaCount == 32)
+  {
+    ui.areas[0][0] = 0;
+    ui.areas[0][1] = 0;
+    ui.areas[0][2] = SCREEN_W - 1;
+    ui.areas[0][3] = SCREEN_H - 1;
+    ui.areaCount = 1;
+    return;
+  }
+  int *a = ui.areas[ui.areaCount++];
+  a[0] = x1;
+  a[1] = y1;
+  a[2] = x2;
+  a[3] = y2;
+}
+
+static void uiPixel(Ui &ui, int x, int y, bool dark)
+{
+  uint8_t bit = 0x80 >> (x & 7);
+  uint8_t &b = ui.screen[y * SCREEN_STRIDE + x / 8];
+  b = dark ? b & ~bit : b | bit;
+}
+
+static void uiFill(Ui &ui, int x1, int y1, int x2, int y2, bool dark)
+{
+  for (int y = y1; y <= y2 && y < SCREEN_H; y++)
+    for (int x = x1; x <= x2 && x < SCREEN_W; x++)
+      uiPixel(ui, x, y, dark);
+}
+
+static void uiText(Ui &ui, int x, int y, int w, int h, const char *text)
+{
+  uiFill(ui, x, y, x + w - 1, y + h - 1, false);
+  for (int i = 0; text[i] && (i + 1) * GLYPH_W <= w; i++)
+  {
+    uint32_t seed = (uint8_t)text[i] * 2654435761u;
+    for (int gy = 2; gy < h - 2 && gy < 14; gy++)
+    {
+      uint32_t row = (seed >> (gy * 2 % 27)) & 0x1F;
+      for (int gx = 0; gx < GLYPH_W - 1; gx++)
+      {
+        if (text[i] != ' ' && (row >> gx) & 1)
+          uiPixel(ui, x + i * GLYPH_W + gx, y + gy, true);
+      }
+    }
+  }
+}
+
+// The home tile: clock, bar and event rows; the other tiles are mostly blank
+static void uiDraw(Ui &ui)
+{
+  if (ui.tile != 0)
+  {
+    uiFill(ui, 0, 0, SCREEN_W - 1, SCREEN_H - 1, false);
+    char label[16];
+    snprintf(label, sizeof(label), "Tile %d", ui.tile);
+    uiText(ui, 8, 56, 80, 16, label);
+    return;
+  }
+
+  uiText(ui, 0, 0, 148, 16, ui.clock);
+  uiFill(ui, 148, 3, 295, 12, false);
+  uiFill(ui, 148, 3, 295, 3, true);
+  uiFill(ui, 148, 12, 295, 12, true);
+  uiFill(ui, 148, 3, 148 + ui.bar * 147 / 59, 12, true);
+  for (int i = 0; i < EVENT_LIST_ROWS; i++)
+  {
+    lv_obj_t *row = ui.list.rows[i];
+    if (row->y + LINE_SPACING <= SCREEN_H)
+      uiText(ui, 0, row->y, SCREEN_W, LINE_SPACING, row->hidden ? "" : row->text);
+  }
+}
+
+// Mark the rows LVGL would invalidate
+static void uiRowsChanged(Ui &ui)
+{
+  for (int i = 0; i < EVENT_LIST_ROWS; i++)
+  {
+    lv_obj_t *row = ui.list.rows[i];
+    if (row->dirty && ui.tile == 0 && row->y < SCREEN_H)
+      uiInvalidate(ui, 0, row->y, SCREEN_W - 1, row->y + LINE_SPACING - 1);
+    row->dirty = false;
+  }
+}
+
+static void uiApplyGesture(Ui &ui, const GestureResult &g, int64_t now)
+{
+  int tile = ui.tile;
+  uint32_t length = eventListRange(ui.events, now / 1000000).length;
+  switch (g.gesture)
+  {
+  case GESTURE_LEFT:
+    tile = tile == 0 ? 0 : tile - 1;
+    break;
+  case GESTURE_RIGHT:
+    tile = tile == TILES - 1 ? tile : tile + 1;
+    break;
+  case GESTURE_FORWARD:
+    ui.cursor = ui.cursor + 3 < (int)length ? ui.cursor + 3 : ui.cursor;
+    break;
+  case GESTURE_BACK:
+    ui.cursor = ui.cursor >= 3 ? ui.cursor - 3 : 0;
+    break;
+  default:
+    break;
+  }
+
+  if (tile != ui.tile)
+  {
+    ui.tile = tile;
+    uiInvalidate(ui, 0, 0, SCREEN_W - 1, SCREEN_H - 1);
+  }
+  panelGestureApplied(g.us);
+}
+
+// A fortnight of lectures and a few untimed notes, like an expanded feed
+static EventStore *simEvents(int64_t start)
+{
+  EventStore *store = eventStoreCreate(256, 4096);
+  eventStoreAdd(store, EVENT_UNTIMED, EVENT_UNTIMED, "Bring the lab notes");
+  eventStoreAdd(store, EVENT_UNTIMED, EVENT_UNTIMED, "Library books due");
+  char title[32];
+  for (int day = 0; day < 14; day++)
+  {
+    for (int slot = 0; slot < 6; slot++)
+    {
+      snprintf(title, sizeof(title), "Lecture %d room %d", slot + 1, 100 + slot * 7);
+      int64_t t = start + day * 86400 + slot * 5400 - 3600;
+      eventStoreAdd(store, t, t + 3000, title);
+    }
+  }
+  eventStoreFinish(store);
+  return store;
+}
+
+int main(int argc, char **argv)
+{
+  int minutes = argc > 1 ? atoi(argv[1]) : 10;
+  const char *script = argc > 2 ? argv[2] : "F1500 F1500 B1500 L3000 R3000";
+
+  setenv("TZ", "UTC0", 1);
+  tzset();
+
+  const int64_t epoch = 1700000000;
+  static Ui ui;
+  memset(ui.screen, 0xFF, sizeof(ui.screen));
+  ui.events = simEvents(epoch);
+  ui.bar = -1;
+  eventListCreate(ui.list, nullptr);
+  eventListLayout(ui.list, LINE_SPACING, SCREEN_H);
+
+  hostClockStart(0);
+  panelSimStart();
+  // The screen starts out white, and so does the panel
+  memcpy(frameBuf, panelSim.current, sizeof(frameBuf));
+  memcpy(panelBuf, panelSim.current, sizeof(panelBuf));
+
+  GestureRecognizer recognizer;
+  gestureInit(recognizer, {2088, 400000, 50});
+  MotionSim sensor;
+  motionSimInit(sensor, script, 0);
+  MotionSample batch[SENSOR_BATCH];
+
+  uint32_t renders = 0, recognized = 0, passes = 0;
+  int64_t frameNs = 0, frameMaxNs = 0, panelIdleUs = 0;
+  auto wallStart = std::chrono::steady_clock::now();
+
+  const int64_t endUs = (int64_t)minutes * 60 * 1000000;
+  for (int64_t now = 0; now < endUs; now += STEP_US)
+  {
+    hostClockStart(now);
+
+    int n = motionSimDrain(sensor, batch, SENSOR_BATCH, now);
+    for (int i = 0; i < n; i++)
+    {
+      GestureResult g = gestureFeed(recognizer, batch[i]);
+      if (g.gesture != GESTURE_NONE)
+      {
+        recognized++;
+        uiApplyGesture(ui, g, epoch * 1000000 + now);
+      }
+    }
+
+    // The render task: clock and bar once they change, the list after a gesture
+    time_t t = epoch + now / 1000000;
+    char clock[32];
+    strftime(clock, sizeof(clock), "%H:%M %a, %b %d", gmtime(&t));
+    if (strcmp(clock, ui.clock) != 0)
+    {
+      strcpy(ui.clock, clock);
+      if (ui.tile == 0)
+        uiInvalidate(ui, 0, 0, 147, 15);
+    }
+    if (t % 60 != ui.bar)
+    {
+      ui.bar = t % 60;
+      if (ui.tile == 0)
+        uiInvalidate(ui, 148, 3, 295, 12);
+    }
+    eventListBind(ui.list, ui.events, ui.cursor, t);
+    uiRowsChanged(ui);
+
+    if (ui.areaCount)
+    {
+      auto start = std::chrono::steady_clock::now();
+      uiDraw(ui);
+      for (int i = 0; i < ui.areaCount; i++)
+      {
+        const int *a = ui.areas[i];
+        panelFlush(1, a[0], a[1], a[2], a[3], ui.screen + a[1] * SCREEN_STRIDE + a[0] / 8, SCREEN_STRIDE, true, i == ui.areaCount - 1);
+      }
+      int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+      frameNs += ns;
+      frameMaxNs = ns > frameMaxNs ? ns : frameMaxNs;
+      renders++;
+      ui.areaCount = 0;
+    }
+    panelGesturesRendered();
+
+    // The panel task
+    if (now >= panelIdleUs && hostTaskNotifyTake(panelTaskHandle))
+    {
+      panelRefreshPending();
+      passes++;
+      panelIdleUs = esp_timer_get_time();
+      hostClockStart(now);
+    }
+  }
+
+  // Let the last refresh through
+  hostClockStart(panelIdleUs > endUs ? panelIdleUs : endUs);
+  if (hostTaskNotifyTake(panelTaskHandle))
+  {
+    panelRefreshPending();
+    passes++;
+  }
+
+  double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+  const LatencyStat &l = gestureLatency;
+  printf("{\"minutes\":%d,\"wall_ms\":%.1f,\"speedup\":%.0f,\"samples\":%lu,\"gestures\":%lu,\"renders\":%lu,"
+         "\"frame_us_avg\":%.1f,\"frame_us_max\":%.1f,\"refresh_passes\":%lu,\"partial_refreshes\":%lu,\"full_refreshes\":%lu,"
+         "\"clean_refreshes\":%lu,\"busy_s\":%.1f,\"written_kb\":%lu,"
+         "\"latency_ms_avg\":%.0f,\"latency_ms_max\":%.0f}\n",
+         minutes, wallMs, endUs / 1000.0 / wallMs, (unsigned long)recognizer.samples, (unsigned long)recognized,
+         (unsigned long)renders, renders ? frameNs / 1000.0 / renders : 0.0, frameMaxNs / 1000.0,
+         (unsigned long)passes, (unsigned long)panelSim.partialRefreshes, (unsigned long)panelSim.fullRefreshes,
+         (unsigned long)ghostTracker.cleanRefreshes, panelSim.busyUs / 1e6, (unsigned long)(panelSim.writeBytes / 1024), l.count ? l.totalUs / 1000.0 / l.count : 0.0, l.maxUs / 1000.0);
+
+  free(ui.events);
+  if (memcmp(panelSim.current, frameBuf, sizeof(frameBuf)) != 0)
+  {
+    fprintf(stderr, "The panel does not show the last frame\n");
+    return 1;
+  }
+  return 0;
+}
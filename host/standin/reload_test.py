@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+"""http_client.h across repeated reloads, against standin_server.py.
+
+Runs test_fetch, which is http_client.h built for the host with
+HTTP_STANDIN pointing at the stand-in server, and has it fetch the config
+and two calendar feeds per reload the way the firmware does: revalidating
+what it still holds, and accepting a body only once its check passed.
+Fails unless
+  - only the first reload, and the one after a feed changed, carry bodies;
+  - a rejected body is fetched in full again, never answered with a 304;
+  - a body without ETag or Last-Modified leaves no validators behind.
+
+    python3 reload_test.py --fetch build/test_fetch [--reloads 5]
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+import standin_server
+
+CONFIG = "karrmedia.com/iot/cal/config.json"
+FEEDS = ["calendar.example.edu/lectures.ics", "calendar.example.edu/labs.ics"]
+
+
+def write_fixtures(root):
+    events = ",".join('{"title":"Event number %d","start":%d,"end":%d,"location":"Room %d"}'
+                      % (i, 1700000000 + i * 3600, 1700001800 + i * 3600, i % 20) for i in range(200))
+    feeds = ",".join('{"host":"calendar.example.edu","path":"/%s"}' % f.split("/", 1)[1] for f in FEEDS)
+    files = {CONFIG: '{"tz":"EST5EDT,M3.2.0,M11.1.0","calendars":[%s],"events":[%s]}' % (feeds, events)}
+    for n, feed in enumerate(FEEDS):
+        vevents = "".join("BEGIN:VEVENT\r\nUID:%d-%d\r\nDTSTART:20261019T%02d0000Z\r\nDTEND:20261019T%02d5000Z\r\n"
+                          "SUMMARY:Lecture %d\r\nRRULE:FREQ=WEEKLY;COUNT=12\r\nEND:VEVENT\r\n" % (n, i, 8 + i, 8 + i, i)
+                          for i in range(8))
+        files[feed] = "BEGIN:VCALENDAR\r\nVERSION:2.0\r\n%sEND:VCALENDAR\r\n" % vevents
+    for path, text in files.items():
+        os.makedirs(os.path.dirname(os.path.join(root, path)), exist_ok=True)
+        with open(os.path.join(root, path), "w") as f:
+            f.write(text)
+
+
+def touch(root, path):
+    """Change a file, a second later so Last-Modified moves as well."""
+    time.sleep(1.1)
+    with open(os.path.join(root, path), "a") as f:
+        f.write("\r\n")
+
+
+class Watch:
+    """test_fetch, and what the firmware would still hold per URL."""
+
+    def __init__(self, fetch, port):
+        self.proc = subprocess.Popen([fetch, "127.0.0.1:%d" % port], stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                                     text=True)
+        self.held = set()
+
+    def fetch(self, path, accept=True):
+        self.proc.stdin.write("%s %d %d\n" % (path, path in self.held, accept))
+        self.proc.stdin.flush()
+        line = self.proc.stdout.readline()
+        if not line:
+            raise RuntimeError("test_fetch exited")
+        result = json.loads(line)
+        if result["result"] == "ok" and accept:
+            self.held.add(path)
+        return result
+
+    def close(self):
+        self.proc.stdin.close()
+        return self.proc.wait()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--fetch", required=True, help="the test_fetch binary")
+    parser.add_argument("--reloads", type=int, default=5)
+    args = parser.parse_args()
+
+    failures = []
+
+    def expect(what, cond):
+        if not cond:
+            failures.append(what)
+
+    with tempfile.TemporaryDirectory() as root:
+        write_fixtures(root)
+        bare = set()
+        server, counter = standin_server.start(root, quiet=True, bare=bare)
+        watch = Watch(args.fetch, server.server_address[1])
+
+        def reload(n, expect_bodies, reject=()):
+            before = counter.snapshot()
+            results = {path: watch.fetch(path, path not in reject) for path in [CONFIG] + FEEDS}
+            counter.wait(before["requests"] + len(results))
+            after = counter.snapshot()
+            print(json.dumps({"reload": n, "wire_bytes": after["wire_bytes"] - before["wire_bytes"],
+                              "body_bytes": after["body_bytes"] - before["body_bytes"],
+                              "not_modified": after["not_modified"] - before["not_modified"]}))
+            bodies = sorted(path for path, r in results.items() if r["result"] == "ok")
+            expect("reload %d: bodies for %s, expected %s" % (n, bodies, sorted(expect_bodies)),
+                   bodies == sorted(expect_bodies))
+            expect("reload %d: a fetch failed" % n, all(r["result"] != "failed" for r in results.values()))
+            return results
+
+        n = 1
+        first = reload(n, [CONFIG] + FEEDS)
+        expect("validators not kept after the first reload", all(r["kept"] for r in first.values()))
+        for n in range(2, args.reloads + 1):
+            reload(n, [])
+
+        # One feed changes
+        touch(root, FEEDS[1])
+        n += 1
+        reload(n, [FEEDS[1]])
+
+        # A config that fails its check: fetched in full until one passes
+        touch(root, CONFIG)
+        n += 1
+        reload(n, [CONFIG], reject=[CONFIG])
+        n += 1
+        reload(n, [CONFIG])
+        n += 1
+        reload(n, [])
+
+        # A server that stops sending validators: what was kept for the URL goes
+        bare.add(FEEDS[0])
+        n += 1
+        results = reload(n, [FEEDS[0]])
+        expect("validators still kept for a body without any", not results[FEEDS[0]]["kept"])
+        n += 1
+        reload(n, [FEEDS[0]])
+
+        # Kept alive throughout, one connection per host
+        handshakes = results[FEEDS[1]]["handshakes"]
+        expect("%d connections to 2 hosts" % handshakes, handshakes == 2)
+
+        total = counter.snapshot()
+        total["reloads"] = n
+        print(json.dumps(total))
+        expect("test_fetch failed", watch.close() == 0)
+        server.shutdown()
+        server.server_close()
+
+    for f in failures:
+        print(f, file=sys.stderr)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+"""Stand-in for the config and calendar servers, for builds with HTTP_STANDIN.
+
+Serves ROOT/<host><path> for GET /<host><path>, the way http.h asks for
+https://<host><path> when HTTP_STANDIN is set. Answers with an ETag and a
+Last-Modified and honours If-None-Match and If-Modified-Since with a 304,
+so revalidation can be watched without the real servers. Every response is
+logged as one JSON line with the bytes it put on the wire. Paths in bare
+are served without either, like a server that cannot be revalidated.
+
+    python3 standin_server.py ROOT [--port 8000]
+
+With ROOT holding karrmedia.com/iot/cal/config.json, set HTTP_STANDIN to
+this machine's "address:port" and hit /reload on the watch.
+"""
+
+import argparse
+import email.utils
+import hashlib
+import json
+import os
+import sys
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class Counter:
+    """Bytes sent, per response and in total."""
+
+    def __init__(self):
+        self.lock = threading.Condition()
+        self.requests = 0
+        self.not_modified = 0
+        self.body_bytes = 0
+        self.wire_bytes = 0
+
+    def add(self, status, body, wire):
+        with self.lock:
+            self.requests += 1
+            self.not_modified += status == 304
+            self.body_bytes += body
+            self.wire_bytes += wire
+            self.lock.notify_all()
+
+    def wait(self, requests, timeout=5):
+        """Until that many responses are counted; the client can read one before it is."""
+        with self.lock:
+            self.lock.wait_for(lambda: self.requests >= requests, timeout)
+
+    def snapshot(self):
+        with self.lock:
+            return {"requests": self.requests, "not_modified": self.not_modified,
+                    "body_bytes": self.body_bytes, "wire_bytes": self.wire_bytes}
+
+
+class CountingWriter:
+    def __init__(self, raw):
+        self.raw = raw
+        self.count = 0
+
+    def write(self, data):
+        self.count += len(data)
+        return self.raw.write(data)
+
+    def flush(self):
+        self.raw.flush()
+
+
+class Handler(BaseHTTPRequestHandler):
+    # Keep-alive, as the watch reuses its connection per host
+    protocol_version = "HTTP/1.1"
+    root = "."
+    counter = None
+    quiet = False
+    bare = set()
+
+    def setup(self):
+        super().setup()
+        self.wfile = CountingWriter(self.wfile)
+
+    def finish(self):
+        self.wfile = self.wfile.raw
+        super().finish()
+
+    def log_message(self, format, *args):
+        pass
+
+    def do_GET(self):
+        self.wfile.count = 0
+        path = os.path.normpath(self.path.split("?", 1)[0]).lstrip("/")
+        file = os.path.join(self.root, path)
+        if path.startswith("..") or not os.path.isfile(file):
+            self.reply(404, b"Not found\n")
+            return
+
+        with open(file, "rb") as f:
+            body = f.read()
+        etag = '"%s"' % hashlib.sha1(body).hexdigest()[:16]
+        mtime = int(os.path.getmtime(file))
+        last_modified = email.utils.formatdate(mtime, usegmt=True)
+
+        if path in self.bare:
+            self.reply(200, body)
+        elif self.unchanged(etag, mtime):
+            self.reply(304, b"", etag, last_modified)
+        else:
+            self.reply(200, body, etag, last_modified)
+
+    def unchanged(self, etag, mtime):
+        # If-None-Match wins over If-Modified-Since, as RFC 9110 has it
+        match = self.headers.get("If-None-Match")
+        if match is not None:
+            return etag in [t.strip() for t in match.split(",")] or match.strip() == "*"
+        since = self.headers.get("If-Modified-Since")
+        if since is not None:
+            try:
+                return mtime <= email.utils.parsedate_to_datetime(since).timestamp()
+            except (TypeError, ValueError):
+                return False
+        return False
+
+    def reply(self, status, body, etag=None, last_modified=None):
+        self.send_response(status)
+        if etag:
+            self.send_header("ETag", etag)
+            self.send_header("Last-Modified", last_modified)
+        if status != 304:
+            self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        if status != 304:
+            self.wfile.write(body)
+        self.wfile.flush()
+
+        self.counter.add(status, len(body) if status != 304 else 0, self.wfile.count)
+        if not self.quiet:
+            print(json.dumps({"path": self.path, "status": status, "body_bytes": len(body) if status != 304 else 0,
+                              "wire_bytes": self.wfile.count}), flush=True)
+
+
+def start(root, port=0, quiet=False, bare=None):
+    """Serve root on localhost:port in a thread, returns the server and its counter.
+
+    bare is a set of paths under root, it can be changed while serving."""
+    handler = type("StandinHandler", (Handler,), {"root": root, "counter": Counter(), "quiet": quiet,
+                                                  "bare": bare if bare is not None else set()})
+    server = ThreadingHTTPServer(("", port), handler)
+    server.daemon_threads = True
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server, handler.counter
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("root", help="directory holding <host>/<path>")
+    parser.add_argument("--port", type=int, default=8000)
+    args = parser.parse_args()
+
+    server, counter = start(args.root, args.port)
+    print("Serving %s on port %d" % (os.path.abspath(args.root), server.server_address[1]), file=sys.stderr)
+    try:
+        threading.Event().wait()
+    except KeyboardInterrupt:
+        pass
+    server.shutdown()
+    print(json.dumps(counter.snapshot()))
+
+
+if __name__ == "__main__":
+    main()
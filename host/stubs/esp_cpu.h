@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_timer.h"
+
+// The cycle counter, at the board's clock rate off esp_timer
+
+#ifndef CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ 160
+#endif
+
+static inline uint32_t esp_cpu_get_cycle_count()
+{
+  return (uint32_t)(esp_timer_get_time() * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+}
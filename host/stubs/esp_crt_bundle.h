@@ -0,0 +1,5 @@
+#pragma once
+
+#include "esp_err.h"
+
+static inline esp_err_t esp_crt_bundle_attach(void *) { return ESP_OK; }
@@ -0,0 +1,454 @@
+#pragma once
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "esp_err.h"
+
+// esp_http_client on the host: plain HTTP/1.1 over a blocking socket, with
+// keep-alive, Content-Length and chunked bodies, redirects and the events
+// http_client.h listens to. No TLS, so only HTTP_STANDIN builds can fetch.
+
+#define ESP_ERR_HTTP_BASE 0x7000
+#define ESP_ERR_HTTP_CONNECT (ESP_ERR_HTTP_BASE + 3)
+#define ESP_ERR_HTTP_WRITE_DATA (ESP_ERR_HTTP_BASE + 4)
+#define ESP_ERR_HTTP_INVALID_TRANSPORT (ESP_ERR_HTTP_BASE + 7)
+
+#define HOST_HTTP_TIMEOUT_S 5
+
+enum esp_http_client_transport_t
+{
+  HTTP_TRANSPORT_UNKNOWN,
+  HTTP_TRANSPORT_OVER_TCP,
+  HTTP_TRANSPORT_OVER_SSL,
+};
+
+enum esp_http_client_event_id_t
+{
+  HTTP_EVENT_ERROR,
+  HTTP_EVENT_ON_CONNECTED,
+  HTTP_EVENT_HEADER_SENT,
+  HTTP_EVENT_ON_HEADER,
+  HTTP_EVENT_ON_DATA,
+  HTTP_EVENT_ON_FINISH,
+  HTTP_EVENT_DISCONNECTED,
+  HTTP_EVENT_REDIRECT,
+};
+
+struct esp_http_client;
+typedef esp_http_client *esp_http_client_handle_t;
+
+struct esp_http_client_event_t
+{
+  esp_http_client_event_id_t event_id;
+  esp_http_client_handle_t client;
+  void *data;
+  int data_len;
+  void *user_data;
+  char *header_key;
+  char *header_value;
+};
+
+typedef esp_err_t (*http_event_handle_cb)(esp_http_client_event_t *evt);
+
+struct esp_http_client_config_t
+{
+  const char *url;
+  const char *host;
+  int port;
+  const char *path;
+  esp_http_client_transport_t transport_type;
+  http_event_handle_cb event_handler;
+  void *user_data;
+  esp_err_t (*crt_bundle_attach)(void *conf);
+  bool keep_alive_enable;
+  bool save_client_session;
+};
+
+struct esp_http_client
+{
+  http_event_handle_cb handler;
+  void *userData;
+
+  // Where the next request goes
+  std::string host;
+  int port;
+  std::string path;
+  bool tls;
+  std::vector<std::pair<std::string, std::string>> headers;
+
+  // The connection, and where it goes
+  int fd;
+  std::string connectedHost;
+  int connectedPort;
+  char buf[1024];
+  int len, pos;
+
+  // The response in flight
+  int status;
+  int64_t contentLength; // -1 if chunked or unknown
+  bool chunked;
+  int64_t remaining;     // Of the body, or of the current chunk
+  bool inChunks;         // A chunk was read, its CRLF comes before the next size
+  bool complete;
+  bool keepAlive;
+  std::string location;
+};
+
+static inline void hostHttpEvent(esp_http_client_handle_t client, esp_http_client_event_id_t id, char *key = nullptr, char *value = nullptr)
+{
+  if (!client->handler)
+    return;
+  esp_http_client_event_t evt = {id, client, nullptr, 0, client->userData, key, value};
+  client->handler(&evt);
+}
+
+inline esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+  if (client->fd >= 0)
+  {
+    close(client->fd);
+    client->fd = -1;
+    hostHttpEvent(client, HTTP_EVENT_DISCONNECTED);
+  }
+  client->len = client->pos = 0;
+  return ESP_OK;
+}
+
+// "http://host:port/path", or a path on the current host
+inline esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url)
+{
+  const char *rest = url;
+  if (strncmp(url, "http://", 7) == 0 || strncmp(url, "https://", 8) == 0)
+  {
+    client->tls = url[4] == 's';
+    rest = url + (client->tls ? 8 : 7);
+    const char *slash = strchr(rest, '/');
+    std::string authority(rest, slash ? slash - rest : strlen(rest));
+    size_t colon = authority.rfind(':');
+    client->host = authority.substr(0, colon);
+    client->port = colon == std::string::npos ? (client->tls ? 443 : 80) : atoi(authority.c_str() + colon + 1);
+    rest = slash ? slash : "/";
+  }
+  client->path = rest;
+  return ESP_OK;
+}
+
+inline esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+  esp_http_client *client = new esp_http_client();
+  client->handler = config->event_handler;
+  client->userData = config->user_data;
+  client->fd = -1;
+  client->host = config->host ? config->host : "";
+  client->port = config->port ? config->port : 80;
+  client->path = config->path ? config->path : "/";
+  client->tls = config->transport_type == HTTP_TRANSPORT_OVER_SSL;
+  if (config->url)
+    esp_http_client_set_url(client, config->url);
+  return client;
+}
+
+inline esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+  esp_http_client_close(client);
+  delete client;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+  for (auto &header : client->headers)
+  {
+    if (strcasecmp(header.first.c_str(), key) == 0)
+    {
+      header.second = value;
+      return ESP_OK;
+    }
+  }
+  client->headers.push_back({key, value});
+  return ESP_OK;
+}
+
+inline esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char *key)
+{
+  for (size_t i = 0; i < client->headers.size(); i++)
+  {
+    if (strcasecmp(client->headers[i].first.c_str(), key) == 0)
+    {
+      client->headers.erase(client->headers.begin() + i);
+      break;
+    }
+  }
+  return ESP_OK;
+}
+
+static inline bool hostHttpConnect(esp_http_client_handle_t client)
+{
+  addrinfo hints = {};
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addrs;
+  char port[8];
+  snprintf(port, sizeof(port), "%d", client->port);
+  if (getaddrinfo(client->host.c_str(), port, &hints, &addrs) != 0)
+    return false;
+
+  for (addrinfo *a = addrs; a; a = a->ai_next)
+  {
+    int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, a->ai_addr, a->ai_addrlen) == 0)
+    {
+      timeval timeout = {HOST_HTTP_TIMEOUT_S, 0};
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      client->fd = fd;
+      break;
+    }
+    close(fd);
+  }
+  freeaddrinfo(addrs);
+  if (client->fd < 0)
+    return false;
+
+  client->connectedHost = client->host;
+  client->connectedPort = client->port;
+  hostHttpEvent(client, HTTP_EVENT_ON_CONNECTED);
+  return true;
+}
+
+// Send a GET with no body; write_len is for requests with one, which the host does not need
+inline esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+  if (client->tls || write_len != 0)
+    return ESP_ERR_HTTP_INVALID_TRANSPORT;
+
+  if (client->fd >= 0 && (client->connectedHost != client->host || client->connectedPort != client->port))
+    esp_http_client_close(client);
+  if (client->fd < 0 && !hostHttpConnect(client))
+    return ESP_ERR_HTTP_CONNECT;
+
+  std::string request = "GET " + client->path + " HTTP/1.1\r\nHost: " + client->host + ":" + std::to_string(client->port) + "\r\n";
+  for (const auto &header : client->headers)
+    request += header.first + ": " + header.second + "\r\n";
+  request += "\r\n";
+
+  if (send(client->fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size())
+  {
+    esp_http_client_close(client);
+    return ESP_ERR_HTTP_WRITE_DATA;
+  }
+  hostHttpEvent(client, HTTP_EVENT_HEADER_SENT);
+
+  client->status = 0;
+  client->contentLength = -1;
+  client->chunked = false;
+  client->remaining = 0;
+  client->inChunks = false;
+  client->complete = false;
+  client->keepAlive = true;
+  client->location.clear();
+  return ESP_OK;
+}
+
+// Next byte off the connection, -1 if it closed or failed
+static inline int hostHttpByte(esp_http_client_handle_t client)
+{
+  if (client->pos == client->len)
+  {
+    if (client->fd < 0)
+      return -1;
+    ssize_t n = recv(client->fd, client->buf, sizeof(client->buf), 0);
+    if (n <= 0)
+      return -1;
+    client->len = n;
+    client->pos = 0;
+  }
+  return (uint8_t)client->buf[client->pos++];
+}
+
+// One CRLF terminated line without the CRLF, false if the connection ended first
+static inline bool hostHttpLine(esp_http_client_handle_t client, std::string &line)
+{
+  line.clear();
+  for (int c = hostHttpByte(client); c >= 0; c = hostHttpByte(client))
+  {
+    if (c == '\n')
+    {
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      return true;
+    }
+    line += (char)c;
+  }
+  return false;
+}
+
+// Read up to the next chunk's data, false on a malformed or cut off body
+static inline bool hostHttpNextChunk(esp_http_client_handle_t client)
+{
+  std::string line;
+  if (client->inChunks && !hostHttpLine(client, line))
+    return false;
+  if (!hostHttpLine(client, line))
+    return false;
+  client->inChunks = true;
+  client->remaining = strtoll(line.c_str(), nullptr, 16);
+  if (client->remaining == 0)
+  {
+    // Trailers, up to the empty line
+    while (hostHttpLine(client, line) && !line.empty())
+      ;
+    client->complete = true;
+  }
+  return true;
+}
+
+static inline void hostHttpFinish(esp_http_client_handle_t client)
+{
+  client->complete = true;
+  hostHttpEvent(client, HTTP_EVENT_ON_FINISH);
+  if (!client->keepAlive)
+    esp_http_client_close(client);
+}
+
+// The status line and headers; the content length, 0 if chunked or unknown, -1 on failure
+inline int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+  std::string line;
+  if (!hostHttpLine(client, line) || sscanf(line.c_str(), "HTTP/%*d.%*d %d", &client->status) != 1)
+  {
+    esp_http_client_close(client);
+    return ESP_FAIL;
+  }
+
+  while (true)
+  {
+    if (!hostHttpLine(client, line))
+    {
+      esp_http_client_close(client);
+      return ESP_FAIL;
+    }
+    if (line.empty())
+      break;
+
+    size_t colon = line.find(':');
+    if (colon == std::string::npos)
+      continue;
+    size_t start = line.find_first_not_of(' ', colon + 1);
+    std::string key = line.substr(0, colon);
+    std::string value = start == std::string::npos ? "" : line.substr(start);
+    hostHttpEvent(client, HTTP_EVENT_ON_HEADER, (char *)key.c_str(), (char *)value.c_str());
+
+    if (strcasecmp(key.c_str(), "Content-Length") == 0)
+      client->contentLength = strtoll(value.c_str(), nullptr, 10);
+    else if (strcasecmp(key.c_str(), "Transfer-Encoding") == 0 && strcasecmp(value.c_str(), "chunked") == 0)
+      client->chunked = true;
+    else if (strcasecmp(key.c_str(), "Connection") == 0 && strcasecmp(value.c_str(), "close") == 0)
+      client->keepAlive = false;
+    else if (strcasecmp(key.c_str(), "Location") == 0)
+      client->location = value;
+  }
+
+  bool bodyless = client->status == 204 || client->status == 304 || client->status / 100 == 1;
+  if (bodyless || (!client->chunked && client->contentLength == 0))
+  {
+    hostHttpFinish(client);
+  }
+  else if (client->chunked)
+  {
+    // The first chunk size is read on the first read
+    client->contentLength = -1;
+  }
+  else if (client->contentLength > 0)
+  {
+    client->remaining = client->contentLength;
+  }
+  else
+  {
+    // Until the server closes
+    client->keepAlive = false;
+    client->remaining = INT64_MAX;
+  }
+  return client->contentLength > 0 ? client->contentLength : 0;
+}
+
+// Body bytes, 0 once it is all read, -1 if the connection failed first
+inline int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len)
+{
+  int done = 0;
+  while (done < len && !client->complete)
+  {
+    if (client->chunked && client->remaining == 0)
+    {
+      if (!hostHttpNextChunk(client))
+      {
+        esp_http_client_close(client);
+        return done ? done : -1;
+      }
+      if (client->complete)
+      {
+        hostHttpFinish(client);
+        break;
+      }
+    }
+
+    int c = hostHttpByte(client);
+    if (c < 0)
+    {
+      if (client->remaining == INT64_MAX)
+      {
+        hostHttpFinish(client);
+        break;
+      }
+      esp_http_client_close(client);
+      return done ? done : -1;
+    }
+    buffer[done++] = (char)c;
+    if (--client->remaining == 0 && !client->chunked)
+      hostHttpFinish(client);
+  }
+
+  if (done)
+  {
+    esp_http_client_event_t evt = {HTTP_EVENT_ON_DATA, client, buffer, done, client->userData, nullptr, nullptr};
+    if (client->handler)
+      client->handler(&evt);
+  }
+  return done;
+}
+
+inline esp_err_t esp_http_client_flush_response(esp_http_client_handle_t client, int *len)
+{
+  char buffer[256];
+  int total = 0, n;
+  while ((n = esp_http_client_read(client, buffer, sizeof(buffer))) > 0)
+    total += n;
+  if (len)
+    *len = total;
+  return n < 0 ? ESP_FAIL : ESP_OK;
+}
+
+inline esp_err_t esp_http_client_set_redirection(esp_http_client_handle_t client)
+{
+  if (client->location.empty())
+    return ESP_ERR_INVALID_ARG;
+  return esp_http_client_set_url(client, client->location.c_str());
+}
+
+inline int esp_http_client_get_status_code(esp_http_client_handle_t client) { return client->status; }
+inline int64_t esp_http_client_get_content_length(esp_http_client_handle_t client) { return client->contentLength; }
+inline bool esp_http_client_is_chunked_response(esp_http_client_handle_t client) { return client->chunked; }
+inline bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client) { return client->complete; }
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdio.h>
+
+// Errors and warnings go to stderr, the rest is dropped
+
+static inline void hostLogDrop(const char *, ...) {}
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) hostLogDrop(format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) hostLogDrop(format, ##__VA_ARGS__)
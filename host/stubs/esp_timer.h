@@ -0,0 +1,127 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include "esp_err.h"
+
+// esp_timer on the host. The clock counts this thread's CPU time, so a
+// benchmark is not charged for time the PC gave to others, until a
+// simulation calls hostClockStart(). From then on the clock is virtual: it
+// only moves through hostClockAdvance() or a FreeRTOS stub waiting, and
+// timers fire in order as it passes them.
+
+typedef void (*esp_timer_cb_t)(void *arg);
+
+struct esp_timer_create_args_t
+{
+  esp_timer_cb_t callback;
+  void *arg;
+  int dispatch_method;
+  const char *name;
+  bool skip_unhandled_events;
+};
+
+struct esp_timer
+{
+  esp_timer_cb_t callback;
+  void *arg;
+  int64_t dueUs;
+  int64_t periodUs;
+  bool armed;
+};
+typedef esp_timer *esp_timer_handle_t;
+
+#define HOST_TIMERS 8
+
+inline bool hostClockVirtual = false;
+inline int64_t hostClockUs = 0;
+inline esp_timer hostTimers[HOST_TIMERS];
+inline int hostTimerCount = 0;
+
+static inline int64_t esp_timer_get_time()
+{
+  if (hostClockVirtual)
+    return hostClockUs;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out)
+{
+  if (hostTimerCount == HOST_TIMERS)
+    return ESP_ERR_NO_MEM;
+  esp_timer *t = &hostTimers[hostTimerCount++];
+  *t = {args->callback, args->arg, 0, 0, false};
+  *out = t;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t t, uint64_t us)
+{
+  t->dueUs = esp_timer_get_time() + (int64_t)us;
+  t->periodUs = 0;
+  t->armed = true;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t t, uint64_t us)
+{
+  t->dueUs = esp_timer_get_time() + (int64_t)us;
+  t->periodUs = (int64_t)us;
+  t->armed = true;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_stop(esp_timer_handle_t t)
+{
+  if (!t->armed)
+    return ESP_ERR_INVALID_STATE;
+  t->armed = false;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_delete(esp_timer_handle_t t)
+{
+  t->armed = false;
+  t->callback = nullptr;
+  return ESP_OK;
+}
+
+inline void hostClockStart(int64_t us)
+{
+  hostClockVirtual = true;
+  hostClockUs = us;
+}
+
+// The armed timer due first, if it is due by untilUs
+inline esp_timer *hostTimerNext(int64_t untilUs)
+{
+  esp_timer *next = nullptr;
+  for (int i = 0; i < hostTimerCount; i++)
+  {
+    esp_timer *t = &hostTimers[i];
+    if (t->armed && t->dueUs <= untilUs && (next == nullptr || t->dueUs < next->dueUs))
+      next = t;
+  }
+  return next;
+}
+
+// Move the virtual clock on to untilUs, firing the timers due on the way
+inline void hostClockAdvance(int64_t untilUs)
+{
+  while (esp_timer *t = hostTimerNext(untilUs))
+  {
+    if (t->dueUs > hostClockUs)
+      hostClockUs = t->dueUs;
+    if (t->periodUs)
+      t->dueUs += t->periodUs;
+    else
+      t->armed = false;
+    t->callback(t->arg);
+  }
+  if (untilUs > hostClockUs)
+    hostClockUs = untilUs;
+}
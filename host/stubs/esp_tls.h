@@ -0,0 +1,16 @@
+#pragma once
+
+#include "esp_err.h"
+
+// No TLS on the host, so there is never a TLS error to report
+
+typedef void *esp_tls_error_handle_t;
+
+static inline esp_err_t esp_tls_get_and_clear_last_error(esp_tls_error_handle_t, int *tlsCode, int *tlsFlags)
+{
+  if (tlsCode)
+    *tlsCode = 0;
+  if (tlsFlags)
+    *tlsFlags = 0;
+  return ESP_OK;
+}
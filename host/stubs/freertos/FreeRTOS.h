@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_timer.h"
+
+// FreeRTOS on the host, for one thread. Tasks are registered but never run;
+// a host driver calls what their loops would. A wait that is not satisfied
+// at once can only be satisfied by a timer on the virtual clock, so it runs
+// the clock on through the timers due before its timeout, and fails once
+// there are none left.
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portYIELD_FROM_ISR(woken) (void)(woken)
+
+// Until ready() holds or ticks have passed on the virtual clock
+template <typename Ready>
+bool hostWait(TickType_t ticks, Ready ready)
+{
+  if (ready())
+    return true;
+  if (!hostClockVirtual || ticks == 0)
+    return false;
+
+  int64_t deadline = ticks == portMAX_DELAY ? INT64_MAX : hostClockUs + (int64_t)ticks * 1000 / configTICK_RATE_HZ;
+  while (esp_timer *t = hostTimerNext(deadline))
+  {
+    hostClockAdvance(t->dueUs);
+    if (ready())
+      return true;
+  }
+  if (deadline != INT64_MAX)
+    hostClockAdvance(deadline);
+  return false;
+}
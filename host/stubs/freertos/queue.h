@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+
+struct HostQueue
+{
+  uint8_t *items;
+  UBaseType_t length;
+  UBaseType_t size;
+  UBaseType_t head;
+  UBaseType_t count;
+};
+typedef HostQueue *QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t size)
+{
+  return new HostQueue{(uint8_t *)malloc(length * size), length, size, 0, 0};
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks)
+{
+  if (!hostWait(ticks, [&]() { return q->count < q->length; }))
+    return pdFALSE;
+  memcpy(q->items + (q->head + q->count++) % q->length * q->size, item, q->size);
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks)
+{
+  if (!hostWait(ticks, [&]() { return q->count > 0; }))
+    return pdFALSE;
+  memcpy(item, q->items + q->head * q->size, q->size);
+  q->head = (q->head + 1) % q->length;
+  q->count--;
+  return pdTRUE;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+// Mutexes, binary and counting semaphores are all a count with a ceiling
+
+struct HostSemaphore
+{
+  UBaseType_t count;
+  UBaseType_t max;
+};
+typedef HostSemaphore *SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+  return new HostSemaphore{initial, max};
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return xSemaphoreCreateCounting(1, 1); }
+inline SemaphoreHandle_t xSemaphoreCreateBinary() { return xSemaphoreCreateCounting(1, 0); }
+inline void vSemaphoreDelete(SemaphoreHandle_t s) { delete s; }
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t s)
+{
+  if (s->count == s->max)
+    return pdFALSE;
+  s->count++;
+  return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t s, BaseType_t *woken)
+{
+  BaseType_t given = xSemaphoreGive(s);
+  if (given && woken)
+    *woken = pdTRUE;
+  return given;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks)
+{
+  if (!hostWait(ticks, [&]() { return s->count > 0; }))
+    return pdFALSE;
+  s->count--;
+  return pdTRUE;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+// Tasks only keep their notification count; a host driver runs their loops
+
+typedef void (*TaskFunction_t)(void *);
+
+struct HostTask
+{
+  TaskFunction_t fn;
+  void *arg;
+  uint32_t notified;
+};
+typedef HostTask *TaskHandle_t;
+
+inline BaseType_t xTaskCreate(TaskFunction_t fn, const char *, uint32_t, void *arg, UBaseType_t, TaskHandle_t *out)
+{
+  HostTask *task = new HostTask{fn, arg, 0};
+  if (out)
+    *out = task;
+  return pdPASS;
+}
+
+// The task whose loop a host driver is running, if any
+inline HostTask *hostCurrentTask = nullptr;
+
+inline void vTaskDelete(TaskHandle_t) {}
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return hostCurrentTask; }
+
+inline void vTaskDelay(TickType_t ticks)
+{
+  hostWait(ticks, []() { return false; });
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+  task->notified++;
+  return pdPASS;
+}
+
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+  task->notified++;
+  if (woken)
+    *woken = pdTRUE;
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+  HostTask *task = hostCurrentTask;
+  if (!task || !hostWait(ticks, [&]() { return task->notified > 0; }))
+    return 0;
+  uint32_t n = task->notified;
+  task->notified = clear ? 0 : n - 1;
+  return n;
+}
+
+// Take a task's notifications, as its own ulTaskNotifyTake(pdTRUE, 0) would
+inline uint32_t hostTaskNotifyTake(TaskHandle_t task)
+{
+  uint32_t n = task->notified;
+  task->notified = 0;
+  return n;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string.h>
+
+// newlib has strlcpy; glibc only from 2.38
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+static inline size_t hostStrlcpy(char *dst, const char *src, size_t size)
+{
+  size_t len = strlen(src);
+  if (size)
+  {
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = 0;
+  }
+  return len;
+}
+#define strlcpy hostStrlcpy
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+
+// Just enough of LVGL for event_list.h: a label keeps its text, position
+// and visibility so the host driver can draw it.
+
+#define LV_LABEL_LONG_CLIP 0
+#define LV_OBJ_FLAG_HIDDEN 1
+
+struct lv_obj_t
+{
+  const char *text;
+  int32_t x, y;
+  int32_t width;
+  bool hidden;
+  bool dirty; // Changed since the driver last drew it
+};
+
+#define LV_STUB_OBJECTS 32
+
+inline lv_obj_t lvStubObjects[LV_STUB_OBJECTS];
+inline int lvStubCount = 0;
+
+inline lv_obj_t *lv_label_create(lv_obj_t *)
+{
+  lv_obj_t *obj = &lvStubObjects[lvStubCount++ % LV_STUB_OBJECTS];
+  *obj = {"", 0, 0, 0, false, true};
+  return obj;
+}
+
+inline void lv_label_set_long_mode(lv_obj_t *, int) {}
+inline int32_t lv_pct(int32_t v) { return -v; }
+inline void lv_obj_set_width(lv_obj_t *obj, int32_t w) { obj->width = w; }
+
+inline void lv_label_set_text_static(lv_obj_t *obj, const char *text)
+{
+  obj->text = text;
+  obj->dirty = true;
+}
+
+inline void lv_obj_set_pos(lv_obj_t *obj, int32_t x, int32_t y)
+{
+  obj->dirty |= obj->x != x || obj->y != y;
+  obj->x = x;
+  obj->y = y;
+}
+
+inline void lv_obj_add_flag(lv_obj_t *obj, int)
+{
+  obj->dirty |= !obj->hidden;
+  obj->hidden = true;
+}
+
+inline void lv_obj_remove_flag(lv_obj_t *obj, int)
+{
+  obj->dirty |= obj->hidden;
+  obj->hidden = false;
+}
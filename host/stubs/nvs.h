@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "esp_err.h"
+
+// The default NVS partition in memory, for as long as the process runs, so
+// cache.h keeps what it is given. Other partitions are not there: opening
+// one fails, so frame_cache.h loads nothing and saves nothing.
+
+typedef uint32_t nvs_handle_t;
+
+#define NVS_READWRITE 1
+#define ESP_ERR_NVS_BASE 0x1100
+#define ESP_ERR_NVS_NOT_FOUND (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_INVALID_LENGTH (ESP_ERR_NVS_BASE + 0x0c)
+#define ESP_ERR_NVS_NO_FREE_PAGES (ESP_ERR_NVS_BASE + 0x0d)
+#define ESP_ERR_NVS_NEW_VERSION_FOUND (ESP_ERR_NVS_BASE + 0x10)
+
+// Blobs by namespace and key; a handle is its namespace's index plus one
+inline std::vector<std::string> hostNvsNamespaces;
+inline std::map<std::string, std::vector<uint8_t>> hostNvs;
+
+static inline std::string hostNvsKey(nvs_handle_t handle, const char *key)
+{
+  return hostNvsNamespaces[handle - 1] + "/" + key;
+}
+
+static inline esp_err_t nvs_open(const char *name, int, nvs_handle_t *handle)
+{
+  for (size_t i = 0; i < hostNvsNamespaces.size(); i++)
+  {
+    if (hostNvsNamespaces[i] == name)
+    {
+      *handle = i + 1;
+      return ESP_OK;
+    }
+  }
+  hostNvsNamespaces.push_back(name);
+  *handle = hostNvsNamespaces.size();
+  return ESP_OK;
+}
+
+static inline esp_err_t nvs_open_from_partition(const char *, const char *, int, nvs_handle_t *) { return ESP_FAIL; }
+
+// Like IDF: with data null only the length is reported
+static inline esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *data, size_t *len)
+{
+  auto it = hostNvs.find(hostNvsKey(handle, key));
+  if (it == hostNvs.end())
+    return ESP_ERR_NVS_NOT_FOUND;
+  if (data && *len < it->second.size())
+    return ESP_ERR_NVS_INVALID_LENGTH;
+  if (data)
+    memcpy(data, it->second.data(), it->second.size());
+  *len = it->second.size();
+  return ESP_OK;
+}
+
+static inline esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *data, size_t len)
+{
+  hostNvs[hostNvsKey(handle, key)].assign((const uint8_t *)data, (const uint8_t *)data + len);
+  return ESP_OK;
+}
+
+static inline esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+  return hostNvs.erase(hostNvsKey(handle, key)) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+static inline esp_err_t nvs_commit(nvs_handle_t) { return ESP_OK; }
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "calendar.h"
+
+// Which feeds a calendar reload takes in: a 304 on every configured feed
+// changes nothing, unused slots never replace anything, and a feed that came
+// back with events replaces only its own.
+
+// http.h's, which needs the HTTP client
+#define HTTP_NOT_MODIFIED (0x7000 + 0x80)
+#define FEEDS 3
+
+static int failures = 0;
+
+#define CHECK(cond)                                             \
+  do                                                            \
+  {                                                             \
+    if (!(cond))                                                \
+    {                                                           \
+      fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;                                               \
+    }                                                           \
+  } while (0)
+
+static EventStore *feedEvents(const char *title)
+{
+  EventStore *store = eventStoreCreate(4, 256);
+  eventStoreAdd(store, 1700000000, 1700003600, title);
+  eventStoreFinish(store);
+  return store;
+}
+
+// Jobs as loadCalendar() leaves them with the first `configured` slots in use
+static void reload(CalendarJob *jobs, int configured, esp_err_t err)
+{
+  for (int i = 0; i < FEEDS; i++)
+  {
+    jobs[i] = {};
+    jobs[i].err = err;
+    if (i < configured)
+    {
+      snprintf(jobs[i].feed.host, sizeof(jobs[i].feed.host), "feed%d.example", i);
+      strcpy(jobs[i].feed.path, "/cal.ics");
+    }
+  }
+}
+
+int main()
+{
+  EventStore *events[FEEDS] = {feedEvents("A"), feedEvents("B"), nullptr};
+  EventStore *before[FEEDS] = {events[0], events[1], events[2]};
+  CalendarSource fetched[FEEDS] = {};
+  int64_t expandedAt[FEEDS] = {};
+  CalendarJob jobs[FEEDS];
+
+  // Two feeds configured, both answer 304; the third slot is unused and left at ESP_OK
+  reload(jobs, 2, HTTP_NOT_MODIFIED);
+  jobs[2].err = ESP_OK;
+  CHECK(!calendarCollect(jobs, FEEDS, events, fetched, expandedAt, 1700000000));
+  CHECK(memcmp(events, before, sizeof(events)) == 0);
+  CHECK(expandedAt[0] == 0 && expandedAt[1] == 0 && expandedAt[2] == 0);
+
+  // Failed fetches keep what was there too
+  reload(jobs, 2, ESP_FAIL);
+  CHECK(!calendarCollect(jobs, FEEDS, events, fetched, expandedAt, 1700000000));
+  CHECK(memcmp(events, before, sizeof(events)) == 0);
+
+  // Only the feed that loaded something is replaced
+  reload(jobs, 2, HTTP_NOT_MODIFIED);
+  jobs[1].err = ESP_OK;
+  jobs[1].loaded = feedEvents("B2");
+  CHECK(calendarCollect(jobs, FEEDS, events, fetched, expandedAt, 1700000000));
+  CHECK(events[0] == before[0]);
+  CHECK(events[1] == jobs[1].loaded);
+  CHECK(events[2] == nullptr);
+  CHECK(strcmp(fetched[1].host, "feed1.example") == 0 && expandedAt[1] == 1700000000);
+  CHECK(fetched[0].host[0] == 0 && expandedAt[0] == 0);
+
+  for (EventStore *store : events)
+    free(store);
+
+  printf("{\"failures\":%d}\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <string.h>
+
+// Every fetch goes to the stand-in server given on the command line
+static char standinAddress[64];
+#define HTTP_STANDIN standinAddress
+
+#include "http_client.h"
+
+// http_client.h against standin_server.py, driven by reload_test.py. Each
+// line on stdin is one fetch, done the way the firmware does it:
+//
+//   <host><path> <revalidate 0|1> <accept 0|1>
+//
+// revalidate as the caller passes it when it still holds the last accepted
+// body, accept as its check of the body came out. Prints a JSON line per
+// fetch: how it went, the body bytes, and whether validators are now kept
+// for the URL.
+//
+//   test_fetch ADDRESS:PORT
+
+// Reads the body through, as a parser would
+struct CountingSink : HttpSink
+{
+    size_t bytes = 0;
+
+    esp_err_t consume(HttpStream& body) override
+    {
+        char buf[256];
+        size_t n;
+        while ((n = body.readBytes(buf, sizeof(buf))) > 0) {
+            bytes += n;
+        }
+        return ESP_OK;
+    }
+};
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: test_fetch ADDRESS:PORT\n");
+        return 2;
+    }
+    strlcpy(standinAddress, argv[1], sizeof(standinAddress));
+    httpInit();
+
+    char line[320], target[256];
+    int revalidate, accept;
+    while (fgets(line, sizeof(line), stdin)) {
+        if (sscanf(line, "%255s %d %d", target, &revalidate, &accept) != 3 || strchr(target, '/') == nullptr) {
+            fprintf(stderr, "Bad line: %s", line);
+            return 2;
+        }
+        const char* path = strchr(target, '/');
+        char host[64];
+        strlcpy(host, target, MIN(sizeof(host), (size_t)(path - target + 1)));
+
+        CountingSink sink;
+        HttpValidators validators = {};
+        esp_err_t err = httpFetch(host, path, sink, revalidate, &validators);
+        if (err == ESP_OK && accept) {
+            httpAccept(host, path, validators);
+        }
+
+        char url[256];
+        httpUrl(url, sizeof(url), host, path);
+        HttpValidators kept;
+        printf("{\"target\":\"%s\",\"result\":\"%s\",\"bytes\":%d,\"kept\":%s,\"handshakes\":%d}\n", target,
+               err == ESP_OK ? "ok" : err == HTTP_NOT_MODIFIED ? "not_modified" : "failed", (int)sink.bytes,
+               cacheLoad(url, &kept, sizeof(kept)) ? "true" : "false", (int)httpStatsGet().handshakes);
+        fflush(stdout);
+    }
+    return 0;
+}
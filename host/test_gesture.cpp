@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "gesture.h"
+
+// Replays a trace through the recognizer with the device's default config
+// and checks that exactly the gestures on its "# expect:" line come out, in
+// order. Also prints the recognizer's cost per sample.
+//
+//   test_gesture TRACE
+
+static const char gestureLetters[] = "LRFB";
+
+int main(int argc, char **argv)
+{
+  if (argc != 2)
+  {
+    fprintf(stderr, "usage: %s TRACE\n", argv[0]);
+    return 2;
+  }
+
+  FILE *trace = fopen(argv[1], "r");
+  if (trace == nullptr)
+  {
+    perror(argv[1]);
+    return 2;
+  }
+
+  char expected[64] = "";
+  char line[96];
+  std::vector<MotionSample> samples;
+  while (fgets(line, sizeof(line), trace))
+  {
+    MotionSample s;
+    if (sscanf(line, "# expect: %63[LRFB ]", expected) == 1)
+      continue;
+    if (gestureTraceParse(line, s))
+      samples.push_back(s);
+  }
+
+  // accelThreshold 5 m/s^2, inactivityPeriod 2 x motionUpdatePeriod 500 ms, GESTURE_MIN_CONFIDENCE
+  const GestureConfig config = {5 * 4096 * 100 / 981, 1000000, 50};
+
+  GestureRecognizer r;
+  gestureInit(r, config);
+  char recognized[64] = "";
+  size_t n = 0;
+  rewind(trace);
+  uint32_t fed = gestureReplay(r, trace, [&](const GestureResult &g)
+  {
+    printf("%8.2f s  %c  %d%%\n", g.us / 1e6, gestureLetters[g.gesture], (int)g.confidence);
+    if (n + 2 < sizeof(recognized))
+    {
+      n += snprintf(recognized + n, sizeof(recognized) - n, "%s%c", n ? " " : "", gestureLetters[g.gesture]);
+    }
+  });
+  fclose(trace);
+
+  // Cost per sample, without the parsing
+  GestureRecognizer timed;
+  gestureInit(timed, config);
+  auto start = std::chrono::steady_clock::now();
+  for (int pass = 0; pass < 20; pass++)
+  {
+    for (const MotionSample &s : samples)
+    {
+      gestureFeed(timed, s);
+    }
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (20.0 * samples.size());
+
+  printf("{\"samples\":%lu,\"gestures\":%lu,\"rejected\":%lu,\"ns_per_sample\":%.1f,\"expected\":\"%s\",\"recognized\":\"%s\"}\n",
+         (unsigned long)fed, (unsigned long)r.gestures, (unsigned long)r.rejected, ns, expected, recognized);
+
+  if (expected[0] == 0 || strcmp(expected, recognized) != 0)
+  {
+    fprintf(stderr, "Expected \"%s\", recognized \"%s\"\n", expected, recognized);
+    return 1;
+  }
+  return 0;
+}
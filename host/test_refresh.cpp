@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <string.h>
+
+#define PANEL_SIM 1
+
+#include "panel.h"
+
+// panel.h's refresh path against the simulated BUSY line: nothing starts
+// while the panel is busy, areas flushed meanwhile are coalesced into one
+// pass once it goes low, a gesture waits out the busy time, a lost or stale
+// BUSY edge neither hangs a refresh nor ends it early, ghosting is cleaned,
+// a full refresh sends the current frame, and the panel ends up showing it.
+
+#define SCREEN_W 296
+#define SCREEN_H 128
+#define SCREEN_STRIDE (SCREEN_W / 8)
+
+static uint8_t screen[SCREEN_STRIDE * SCREEN_H];
+static int64_t panelIdleUs = 0;
+static int failures = 0;
+
+#define CHECK(cond)                                             \
+  do                                                            \
+  {                                                             \
+    if (!(cond))                                                \
+    {                                                           \
+      fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;                                               \
+    }                                                           \
+  } while (0)
+
+// Darken a logical area and flush it, as one render's flush_cb would
+static void draw(int x1, int y1, int x2, int y2, uint8_t pattern)
+{
+  for (int y = y1; y <= y2; y++)
+    memset(screen + y * SCREEN_STRIDE + x1 / 8, pattern, (x2 - x1 + 1) / 8);
+  panelFlush(1, x1, y1, x2, y2, screen + y1 * SCREEN_STRIDE + x1 / 8, SCREEN_STRIDE, true, true);
+}
+
+// The panel task at nowUs: false if it is still in its last pass or was not woken
+static bool panelStep(int64_t nowUs)
+{
+  hostClockStart(nowUs);
+  if (nowUs < panelIdleUs || !hostTaskNotifyTake(panelTaskHandle))
+    return false;
+
+  panelRefreshPending();
+  panelIdleUs = esp_timer_get_time();
+  return true;
+}
+
+int main()
+{
+  hostClockStart(0);
+  panelSimStart();
+  memset(screen, 0xFF, sizeof(screen));
+  memset(frameBuf, 0xFF, sizeof(frameBuf));
+  memset(panelBuf, 0xFF, sizeof(panelBuf));
+
+  // Idle panel: the first area starts a pass straight away
+  draw(0, 0, 147, 15, 0x0F);
+  CHECK(panelStep(0));
+  CHECK(panelSim.partialRefreshes == 1);
+  CHECK(panelIdleUs == PANEL_SIM_PARTIAL_US);
+
+  // Three renders while BUSY is high: none of them reaches the panel
+  const int64_t gestureUs = 10000;
+  for (int i = 0; i < 3; i++)
+  {
+    int64_t now = 10000 + i * 10000;
+    hostClockStart(now);
+    if (i == 0)
+      panelGestureApplied(gestureUs);
+    draw(0, 16 + i * 16, SCREEN_W - 1, 31 + i * 16, 0x33);
+    CHECK(!panelStep(now));
+  }
+  CHECK(panelSim.partialRefreshes == 1);
+  CHECK(refreshScheduler.count > 0);
+
+  // BUSY goes low: the adjoining rows go out as one window, and the edge ends its wait
+  int64_t low = panelIdleUs;
+  CHECK(panelStep(low));
+  CHECK(panelSim.partialRefreshes == 2);
+  CHECK(refreshScheduler.stats.areas == 4);
+  CHECK(panelIdleUs == low + PANEL_SIM_PARTIAL_US);
+
+  // The gesture waited for the first refresh and then its own
+  CHECK(gestureLatency.count == 1);
+  CHECK(gestureLatency.maxUs == low + PANEL_SIM_PARTIAL_US - gestureUs);
+
+  // An area flushed with nothing changed costs no refresh
+  draw(0, 0, 147, 15, 0x0F);
+  CHECK(panelStep(panelIdleUs));
+  CHECK(panelSim.partialRefreshes == 2);
+
+  // An edge left over from an earlier refresh wakes the wait at once, BUSY is still high
+  xSemaphoreGive(panelReady);
+  int64_t start = panelIdleUs;
+  draw(0, 16, 147, 31, 0x55);
+  CHECK(panelStep(start));
+  CHECK(panelIdleUs == start + PANEL_SIM_PARTIAL_US);
+
+  // Lost edges: every wait ends on its timeout, within one of BUSY going low
+  panelSimMissEdges = true;
+  start = panelIdleUs;
+  draw(0, 32, 147, 47, 0x55);
+  CHECK(panelStep(start));
+  CHECK(panelIdleUs >= start + PANEL_SIM_PARTIAL_US);
+  CHECK(panelIdleUs < start + PANEL_SIM_PARTIAL_US + PANEL_BUSY_POLL_MS * 1000);
+  CHECK(panelSim.partialRefreshes == 4);
+  panelSimMissEdges = false;
+
+  // Flipping the same rows runs them over their ghosting budget, they get cleaned
+  for (int i = 0; i < 64 && ghostTracker.cleanRefreshes == 0; i++)
+  {
+    draw(0, 48, SCREEN_W - 1, 63, i % 2 ? 0x00 : 0xFF);
+    CHECK(panelStep(panelIdleUs));
+  }
+  CHECK(ghostTracker.cleanRefreshes > 0);
+  CHECK(memcmp(panelSim.current, frameBuf, sizeof(frameBuf)) == 0);
+
+  // A full refresh sends what was flushed since the last pass too
+  start = panelIdleUs;
+  draw(0, 64, 147, 79, 0x0F);
+  hostTaskNotifyTake(panelTaskHandle);
+  panelFullRefresh();
+  CHECK(panelSim.fullRefreshes == 1);
+  CHECK(esp_timer_get_time() == start + PANEL_SIM_FULL_US);
+  CHECK(memcmp(panelBuf, frameBuf, sizeof(frameBuf)) == 0);
+
+  CHECK(memcmp(panelSim.current, frameBuf, sizeof(frameBuf)) == 0);
+
+  printf("{\"partial_refreshes\":%lu,\"areas\":%lu,\"latency_ms\":%.0f,\"failures\":%d}\n",
+         (unsigned long)panelSim.partialRefreshes, (unsigned long)refreshScheduler.stats.areas,
+         gestureLatency.maxUs / 1000.0, failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Writes flicks.csv: a synthesized MPU6050 trace for test_gesture.
+
+Not a recording. It is built like motion_sim.h's flicks but with what a
+wrist adds: the watch tilted, sensor noise, gyro bias, flicks of varying
+strength and length, walking steps, a knock on the table and a slow tilt.
+The expected gestures are written in the header so the test can check them.
+
+    python3 make_flicks.py > flicks.csv
+"""
+
+import math
+import random
+
+HZ = 100
+LSB_PER_G = 4096
+GYRO_SCALE = 3000  # About 45 deg/s at +-500 deg/s
+
+random.seed(25)
+samples = []
+expected = []
+us = 0
+gravity = [600, 300, 4030]  # Tilted a little toward the wearer
+bias = [-40, 25, 10]
+
+
+def emit(extra_accel=(0, 0, 0), extra_gyro=(0, 0, 0)):
+    global us
+    a = [gravity[i] + extra_accel[i] + random.gauss(0, 25) for i in range(3)]
+    g = [bias[i] + extra_gyro[i] + random.gauss(0, 20) for i in range(3)]
+    samples.append((us, *[int(v) for v in a], *[int(v) for v in g]))
+    us += 1000000 // HZ
+
+
+def still(ms):
+    for _ in range(ms * HZ // 1000):
+        emit()
+
+
+# Same axes as motion_sim.h: left/right on z with a turn about x,
+# forward/back on x with a turn about y
+AXES = {"L": (2, -1, 0, 1), "R": (2, 1, 0, -1), "F": (0, 1, 1, 1), "B": (0, -1, 1, -1)}
+
+
+def flick(kind, strength, length):
+    axis, sign, gyro_axis, gyro_sign = AXES[kind]
+    for i in range(length):
+        shape = math.sin(math.pi * i / length)
+        accel = [0, 0, 0]
+        gyro = [0, 0, 0]
+        accel[axis] = sign * strength * LSB_PER_G * shape
+        gyro[gyro_axis] = gyro_sign * GYRO_SCALE * shape
+        emit(accel, gyro)
+    expected.append(kind)
+
+
+def walk(steps):
+    # Vertical bumps at 2 Hz, no turn of the wrist
+    for _ in range(steps):
+        for i in range(HZ // 2):
+            bump = 0.35 * LSB_PER_G * math.sin(2 * math.pi * i / (HZ // 2)) if i < HZ // 4 else 0
+            emit((0, bump, bump * 0.3), (0, 0, 0))
+
+
+def knock():
+    emit((0, 0, -2 * LSB_PER_G))
+    emit((0, 0, LSB_PER_G))
+
+
+def tilt(ms):
+    # Turning the wrist slowly: gravity moves from z onto x and back
+    n = ms * HZ // 1000
+    for i in range(n):
+        angle = 0.6 * math.sin(math.pi * i / n)
+        emit((LSB_PER_G * math.sin(angle), 0, -LSB_PER_G * (1 - math.cos(angle))), (0, 400, 0))
+
+
+still(2000)
+for kind, strength, length in [("F", 1.0, 12), ("F", 0.8, 14), ("B", 1.1, 11), ("L", 0.9, 12), ("R", 1.0, 13)]:
+    flick(kind, strength, length)
+    still(1500)
+
+walk(8)
+still(1000)
+flick("B", 0.75, 15)
+still(1200)
+knock()
+still(1500)
+tilt(1500)
+still(1500)
+for kind, strength, length in [("L", 1.2, 10), ("F", 0.9, 12), ("R", 0.8, 14), ("B", 1.0, 12)]:
+    flick(kind, strength, length)
+    still(1200)
+
+print("# Synthesized by make_flicks.py, not recorded; see there for what is in it")
+print("# expect: " + " ".join(expected))
+print("# us,ax,ay,az,gx,gy,gz")
+for s in samples:
+    print(",".join(str(v) for v in s))
@@ -0,0 +1,332 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <esp_timer.h>
+
+#include "pack.h"
+#include "events.h"
+#include "event_list.h"
+#include "gesture.h"
+#include "motion_sim.h"
+
+// Timings of the hot paths on realistic inputs. Each result is printed as
+// one JSON line and compared with a baseline; anything slower by more than
+// the tolerance is a regression. On the board they run at boot when BENCH is
+// set, against the baselines saved in NVS by the first run; set
+// BENCH_REBASELINE to accept the current timings instead. host/bench runs
+// the same set against a checked-in baseline file and fails on a regression.
+
+#ifndef BENCH
+#define BENCH 0
+#endif
+#ifndef BENCH_REBASELINE
+#define BENCH_REBASELINE 0
+#endif
+// The config parse needs ArduinoJson, which a host build may not have
+#ifndef BENCH_CONFIG
+#define BENCH_CONFIG 1
+#endif
+
+#if BENCH_CONFIG
+#include <ArduinoJson.h>
+#include "settings.h"
+#endif
+
+// Each result is the best of this many runs
+#ifndef BENCH_RUNS
+#define BENCH_RUNS 5
+#endif
+#ifndef BENCH_RETRIES
+#define BENCH_RETRIES 3
+#endif
+#define BENCH_TOLERANCE 10
+// Iterations are multiplied by this; a PC needs more for a stable time
+#ifndef BENCH_SCALE
+#define BENCH_SCALE 1
+#endif
+
+// Where the baselines are kept, and how far a result may fall behind one
+struct BenchOptions
+{
+  bool (*load)(const char *name, uint32_t &ns);
+  void (*save)(const char *name, uint32_t ns);
+  bool rebaseline;
+  int tolerance; // Percent
+};
+
+// Best time of fn() per iteration, in ns
+template <typename Fn>
+static uint32_t benchTime(int iterations, Fn fn)
+{
+  iterations *= BENCH_SCALE;
+  int64_t best = INT64_MAX;
+  for (int run = 0; run < BENCH_RUNS; run++)
+  {
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < iterations; i++)
+    {
+      fn();
+    }
+    int64_t us = esp_timer_get_time() - start;
+    best = us < best ? us : best;
+  }
+  return (uint32_t)(best * 1000 / iterations);
+}
+
+// Time fn() and check it against its baseline, printing the result; true
+// if it is within the tolerance. A result over it is timed again up to
+// BENCH_RETRIES times and the best kept, so one stall does not read as a
+// regression but a real one still fails every time.
+template <typename Fn>
+static bool benchCheck(const BenchOptions &o, const char *name, int iterations, Fn fn)
+{
+  uint32_t baseline = 0;
+  bool hasBaseline = !o.rebaseline && o.load(name, baseline);
+  uint64_t limit = hasBaseline ? (uint64_t)baseline * (100 + o.tolerance) / 100 : UINT64_MAX;
+
+  uint32_t ns = UINT32_MAX;
+  for (int attempt = 0; attempt == 0 || (attempt <= BENCH_RETRIES && ns > limit); attempt++)
+  {
+    uint32_t again = benchTime(iterations, fn);
+    ns = again < ns ? again : ns;
+  }
+  bool ok = ns <= limit;
+
+  if (!hasBaseline)
+  {
+    baseline = ns;
+    o.save(name, ns);
+  }
+
+  printf("{\"bench\":\"%s\",\"ns\":%lu,\"baseline\":%lu,\"ok\":%s}\n", name, (unsigned long)ns, (unsigned long)baseline, ok ? "true" : "false");
+  return ok;
+}
+
+// What flush_cb did before pack.h: GxEPD2_BW::drawPixel() for every L8 pixel, in rotation 1
+static void benchDrawPixel(uint8_t *frame, int16_t x, int16_t y, bool white)
+{
+  if (x < 0 || x >= 296 || y < 0 || y >= 128)
+    return;
+  int16_t t = x;
+  x = 128 - y - 1;
+  y = t;
+  uint16_t i = x / 8 + y * (128 / 8);
+  if (white)
+    frame[i] = frame[i] | (1 << (7 - x % 8));
+  else
+    frame[i] = frame[i] & (0xFF ^ (1 << (7 - x % 8)));
+}
+
+// flush_cb's conversion of an area into the rotated native frame: the
+// per-pixel loop it replaced, packL8 on the same 8-bit pixels, and packI1
+// on the 1bpp pixels LVGL renders now
+static int benchPack(const BenchOptions &o)
+{
+  static uint8_t frame[(128 / 8) * 296];
+  static uint8_t px[(296 / 8) * 128];
+  static uint8_t l8[296 * 128];
+  for (size_t i = 0; i < sizeof(px); i++)
+  {
+    px[i] = (uint8_t)(i * 37);
+  }
+  for (size_t i = 0; i < sizeof(l8); i++)
+  {
+    l8[i] = px[i / 8] & (0x80 >> (i % 8)) ? 0xFF : 0x00;
+  }
+
+  PackTarget target = {frame, 128, 296, 1};
+  int failed = 0;
+  // The whole screen, then the 64x32 area at (64,32) a typical partial
+  // refresh flushes, with the area's own pixels at its own stride
+  auto perPixel = [&]()
+  {
+    const uint8_t *buf = l8;
+    for (int y = 0; y <= 127; y++)
+    {
+      for (int x = 0; x <= 295; x++)
+      {
+        benchDrawPixel(frame, x, y, *buf++ > PACK_THRESHOLD);
+      }
+    }
+  };
+  auto perPixelPartial = [&]()
+  {
+    const uint8_t *buf = l8;
+    for (int y = 32; y <= 63; y++)
+    {
+      for (int x = 64; x <= 127; x++)
+      {
+        benchDrawPixel(frame, x, y, *buf++ > PACK_THRESHOLD);
+      }
+    }
+  };
+  auto l8Full = [&]()
+  {
+    packL8(target, 0, 0, 295, 127, l8, 296);
+  };
+  auto l8Partial = [&]()
+  {
+    packL8(target, 64, 32, 127, 63, l8, 64);
+  };
+  auto full = [&]()
+  {
+    packI1(target, 0, 0, 295, 127, px, 296 / 8);
+  };
+  auto partial = [&]()
+  {
+    packI1(target, 64, 32, 127, 63, px, 64 / 8);
+  };
+  failed += !benchCheck(o, "drawPixel.full", 5, perPixel);
+  failed += !benchCheck(o, "packL8.full", 20, l8Full);
+  failed += !benchCheck(o, "packI1.full", 20, full);
+  failed += !benchCheck(o, "drawPixel.partial", 50, perPixelPartial);
+  failed += !benchCheck(o, "packL8.partial", 200, l8Partial);
+  failed += !benchCheck(o, "packI1.partial", 200, partial);
+  return failed;
+}
+
+#if BENCH_CONFIG
+// A config as the server sends it, with that many timed events
+static char *benchConfig(int events)
+{
+  size_t size = 512 + events * 96;
+  char *json = (char *)malloc(size);
+  if (json == nullptr)
+    return nullptr;
+
+  int n = snprintf(json, size, "{\"tz\":\"EST5EDT,M3.2.0,M11.1.0\",\"accelDim\":\"+0\",\"accelThreshold\":5,\"buzzerScale\":1,"
+                               "\"motionUpdatePeriod\":500,\"inactivityPeriod\":2,\"lineSpacing\":10,\"events\":[");
+  for (int i = 0; i < events; i++)
+  {
+    n += snprintf(json + n, size - n, "%s{\"title\":\"Event number %d\",\"start\":%d,\"end\":%d,\"location\":\"Room %d\"}",
+                  i ? "," : "", i, 1700000000 + i * 3600, 1700001800 + i * 3600, i % 20);
+  }
+  snprintf(json + n, size - n, "]}");
+  return json;
+}
+
+// loadConfig's parse and validation, without the network
+static int benchConfigParse(const BenchOptions &o)
+{
+  int failed = 0;
+  for (int events : {10, 500})
+  {
+    char *json = benchConfig(events);
+    if (json == nullptr)
+      return failed + 1;
+
+    auto parse = [&]()
+    {
+      JsonDocument doc;
+      deserializeJson(doc, json);
+      Settings s;
+      EventStore *parsed;
+      settingsFromJson(doc, s, parsed);
+      free(parsed);
+    };
+    char name[32];
+    snprintf(name, sizeof(name), "config.%d", events);
+    failed += !benchCheck(o, name, events < 100 ? 50 : 2, parse);
+    free(json);
+  }
+  return failed;
+}
+#endif
+
+// drawEvents' work short of setting label text: finding the range and formatting a screenful
+static int benchEventList(const BenchOptions &o)
+{
+  int failed = 0;
+  for (int count : {10, 100, 1000, 5000})
+  {
+    EventStore *store = eventStoreCreate(count, 64 * 32);
+    if (store == nullptr)
+      return failed + 1;
+
+    char title[32];
+    for (int i = 0; i < count; i++)
+    {
+      snprintf(title, sizeof(title), "Event %d", i % 64);
+      eventStoreAdd(store, 1700000000 + (int64_t)i * 1800, 1700000000 + (int64_t)i * 1800 + 3600, title);
+    }
+    eventStoreFinish(store);
+
+    int64_t now = 1700000000 + (int64_t)count * 900;
+    auto bind = [&]()
+    {
+      EventListRange r = eventListRange(store, now);
+      char buf[EVENT_LIST_TEXT];
+      for (uint32_t item = 0; item < EVENT_LIST_ROWS && item < r.length; item++)
+      {
+        eventListFormat(store, eventStoreEvents(store)[eventListIndex(r, item)], now, buf, sizeof(buf));
+      }
+    };
+    char name[32];
+    snprintf(name, sizeof(name), "eventList.%d", count);
+    failed += !benchCheck(o, name, 50, bind);
+    free(store);
+  }
+  return failed;
+}
+
+// The gesture recognizer, per sample, over a scripted trace of flicks and stillness
+static int benchGesture(const BenchOptions &o)
+{
+  const int samples = 1000;
+  MotionSample *trace = (MotionSample *)malloc(samples * sizeof(MotionSample));
+  if (trace == nullptr)
+    return 1;
+
+  MotionSim sim;
+  motionSimInit(sim, "F800 B800 L800 R800", 0);
+  for (int i = 0; i < samples; i++)
+  {
+    trace[i] = motionSimNext(sim);
+  }
+
+  GestureRecognizer r;
+  gestureInit(r, {2088, 400000, 50});
+  int i = 0;
+  auto feed = [&]()
+  {
+    gestureFeed(r, trace[i++ % samples]);
+  };
+  bool ok = benchCheck(o, "gesture.sample", samples, feed);
+
+  free(trace);
+  return !ok;
+}
+
+// Run everything, returns how many results regressed
+int benchRun(const BenchOptions &o)
+{
+  int failed = benchPack(o) + benchEventList(o) + benchGesture(o);
+#if BENCH_CONFIG
+  failed += benchConfigParse(o);
+#endif
+  printf("{\"bench\":\"done\",\"regressions\":%d}\n", failed);
+  return failed;
+}
+
+#ifdef ESP_PLATFORM
+#include "cache.h"
+
+static bool benchNvsLoad(const char *name, uint32_t &ns)
+{
+  char key[32];
+  snprintf(key, sizeof(key), "bench.%s", name);
+  return cacheLoad(key, &ns, sizeof(ns));
+}
+
+static void benchNvsSave(const char *name, uint32_t ns)
+{
+  char key[32];
+  snprintf(key, sizeof(key), "bench.%s", name);
+  cacheSave(key, &ns, sizeof(ns));
+}
+
+// Baselines in NVS, from the first run on this board
+const BenchOptions benchNvs = {benchNvsLoad, benchNvsSave, BENCH_REBASELINE, BENCH_TOLERANCE};
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <nvs.h>
+#include <stdio.h>
+#include <string.h>
+
+// Small records kept in NVS across reboots. NVS keys are at most 15
+// characters, so records are found by a hash of their name (e.g. a URL).
+// Call after initArduino(), which initialises the NVS partition.
+
+#define CACHE_NAMESPACE "cache"
+
+nvs_handle_t cacheHandle = 0;
+
+static void cacheKey(const char *name, char key[16])
+{
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (const char *c = name; *c; c++)
+  {
+    hash = (hash ^ (uint8_t)*c) * 16777619u;
+  }
+  snprintf(key, 16, "h%08lx", (unsigned long)hash);
+}
+
+static bool cacheOpen()
+{
+  if (cacheHandle == 0 && nvs_open(CACHE_NAMESPACE, NVS_READWRITE, &cacheHandle) != ESP_OK)
+  {
+    cacheHandle = 0;
+    return false;
+  }
+  return true;
+}
+
+// True if a record of exactly size bytes was found
+bool cacheLoad(const char *name, void *data, size_t size)
+{
+  if (!cacheOpen())
+    return false;
+
+  char key[16];
+  cacheKey(name, key);
+
+  size_t len = size;
+  return nvs_get_blob(cacheHandle, key, data, &len) == ESP_OK && len == size;
+}
+
+// Variable length records: bytes read, 0 if there is none or it is bigger than size
+size_t cacheLoadAny(const char *name, void *data, size_t size)
+{
+  if (!cacheOpen())
+    return 0;
+
+  char key[16];
+  cacheKey(name, key);
+
+  size_t len = size;
+  return nvs_get_blob(cacheHandle, key, data, &len) == ESP_OK ? len : 0;
+}
+
+esp_err_t cacheSave(const char *name, const void *data, size_t size)
+{
+  if (!cacheOpen())
+    return ESP_FAIL;
+
+  char key[16];
+  cacheKey(name, key);
+
+  esp_err_t err = nvs_set_blob(cacheHandle, key, data, size);
+  if (err == ESP_OK)
+    err = nvs_commit(cacheHandle);
+  return err;
+}
+
+esp_err_t cacheErase(const char *name)
+{
+  if (!cacheOpen())
+    return ESP_FAIL;
+
+  char key[16];
+  cacheKey(name, key);
+
+  esp_err_t err = nvs_erase_key(cacheHandle, key);
+  if (err == ESP_OK)
+    err = nvs_commit(cacheHandle);
+  return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "events.h"
+
+// The ICS feeds of the config. Each reload fetches all of them at once, a
+// job per feed, and then takes in the ones that came back with new events.
+
+struct CalendarSource
+{
+  char host[64]; // Unused if empty
+  char path[128];
+};
+
+// One feed, fetched and expanded by its own task
+struct CalendarJob
+{
+  CalendarSource feed;
+  int64_t from, to;
+  bool revalidate;
+  EventStore *loaded;
+  esp_err_t err; // ESP_FAIL until the task is done
+  int64_t us;
+  SemaphoreHandle_t done;
+};
+
+// Replace events[i] with what job i loaded, for the jobs that got new events.
+// Unused slots and feeds that failed or were not modified keep what they had.
+// True if anything was replaced.
+bool calendarCollect(CalendarJob *jobs, int count, EventStore **events, CalendarSource *fetched, int64_t *expandedAt, int64_t now)
+{
+  bool changed = false;
+  for (int i = 0; i < count; i++)
+  {
+    CalendarJob &job = jobs[i];
+    if (job.feed.host[0] == 0 || job.err != ESP_OK)
+      continue;
+
+    free(events[i]);
+    events[i] = job.loaded;
+    fetched[i] = job.feed;
+    expandedAt[i] = now;
+    changed = true;
+  }
+  return changed;
+}
@@ -4,41 +4,102 @@
 #include <GxEPD2_3C.h>
 
 #include "lvgl/lvgl.h"
+#include "panel.h"
+#include "panel_dma.h"
+#include "metrics.h"
+#include "ring_log.h"
 
-GxEPD2_BW<GxEPD2_290_BS, GxEPD2_290_BS::HEIGHT> display(GxEPD2_290_BS(/*CS=5*/ 35, /*DC=*/38, /*RES=*/40, /*BUSY=*/36)); // DEPG0290BS 128x296, SSD1680
+// Drawing goes through frameBuf below, so GxEPD2 only needs a token page buffer
+GxEPD2_BW<GxEPD2_290_BS, 8> display(GxEPD2_290_BS(/*CS=5*/ 35, /*DC=*/38, /*RES=*/40, /*BUSY=*/36)); // DEPG0290BS 128x296, SSD1680
 #define DISPLAY_POWER 33
+#define DISPLAY_BUSY 36
+#define DISPLAY_CS 35
+#define DISPLAY_DC 38
+#define DISPLAY_SCK 39
+#define DISPLAY_MOSI 37
 
+static_assert(PANEL_WIDTH == GxEPD2_290_BS::WIDTH && PANEL_HEIGHT == GxEPD2_290_BS::HEIGHT, "panel.h has the wrong panel size");
 
-#define DISP_BUF_SIZE 128 * 296
+// LVGL renders straight to 1bpp (I1); its buffers start with a 2 entry palette
+#define I1_PALETTE_SIZE 8
+#define DISP_BUF_SIZE (I1_PALETTE_SIZE + ((296 + 7) / 8) * 128)
 
 int pixelShift = 1;
 
+#if !PANEL_SIM
+// GxEPD2 re-initialises the controller (and on the first write clears its RAM) when it
+// is not in partial mode yet. Let it do that now so it never happens after a DMA write.
+void panelArmPartial()
+{
+  display.epd2.writeImagePart(panelBuf, 0, 0, PANEL_WIDTH, PANEL_HEIGHT, 0, 0, 8, 1);
+}
+
+// The image data goes out by DMA, the refreshes through GxEPD2
+static void panelEpdWrite(uint8_t command, int16_t x, int16_t y, int16_t w, int16_t h, bool invert)
+{
+  panelDmaWrite(command, panelBuf, PANEL_WIDTH, x, y, w, h, invert);
+}
+
+static void panelEpdRefresh(int16_t x, int16_t y, int16_t w, int16_t h)
+{
+  METRICS_SPAN(SPAN_PANEL_BUSY);
+  display.epd2.refresh(x, y, w, h);
+}
+
+static void panelEpdFull()
+{
+  display.epd2.writeImageForFullRefresh(panelBuf, 0, 0, PANEL_WIDTH, PANEL_HEIGHT);
+  uint32_t busyStart = metricsNow();
+  display.epd2.refresh(false);
+  metricsRecord(SPAN_PANEL_BUSY, metricsNow() - busyStart);
+  display.epd2.writeImageAgain(panelBuf, 0, 0, PANEL_WIDTH, PANEL_HEIGHT);
+  display.epd2.powerOff();
+
+  panelArmPartial();
+}
+
+static void panelEpdReport()
+{
+  ringLog("Panel SPI %d B/s, %d%% overlap\n", (int)panelDmaThroughput(), panelDmaOverlap());
+}
+#endif
+
+// Call once display.init() is done
+void displayStart()
+{
+#if PANEL_SIM
+  panelSimStart();
+#else
+  CHECK(panelDmaInit(DISPLAY_SCK, DISPLAY_MOSI, DISPLAY_CS, DISPLAY_DC));
+  panelArmPartial();
+
+  display.epd2.setBusyCallback(panelBusyCallback);
+  attachInterrupt(digitalPinToInterrupt(DISPLAY_BUSY), panelBusyIsr, FALLING);
+
+  panelStart({panelEpdWrite, panelEpdRefresh, panelEpdFull, panelEpdReport});
+#endif
+}
+
+// Grow invalidated areas to whole 8x8 blocks so I1 areas transpose into whole native bytes
+void rounder_cb(lv_event_t *e)
+{
+  lv_area_t *area = (lv_area_t *)lv_event_get_param(e);
+
+  area->x1 &= ~7;
+  area->y1 &= ~7;
+  area->x2 |= 7;
+  area->y2 |= 7;
+}
+
 void flush_cb(lv_display_t *drv, const lv_area_t *area, uint8_t *px_map)
 {
-  uint8_t *buf = (uint8_t *)px_map; /*Let's say it's a 16 bit (RGB565) display*/
-  for (int y = area->y1; y <= area->y2; y++)
-  {
-    for (int x = area->x1; x <= area->x2; x++)
-    {
-      uint16_t color = (*buf > 127) ? GxEPD_WHITE : GxEPD_BLACK;
-      
-      display.drawPixel((int16_t)x, (int16_t)y, color);
-
-      buf++;
-    }
-  }
-
-  if (lv_area_get_width(area) == display.width() && lv_area_get_height(area) == display.height())
-  {
-    printf("Full update!");
-    display.display(true);
-  }
-  else
-  {
-    printf("Partial update!");
-    display.displayWindow(area->x1, area->y1, lv_area_get_width(area), lv_area_get_height(area));
-  }
+  lv_color_format_t cf = lv_display_get_color_format(drv);
+  uint32_t stride = lv_draw_buf_width_to_stride(lv_area_get_width(area), cf);
+  bool i1 = cf == LV_COLOR_FORMAT_I1;
+
+  panelFlush(display.getRotation(), area->x1, area->y1, area->x2, area->y2,
+             i1 ? px_map + I1_PALETTE_SIZE : px_map, stride, i1, lv_display_flush_is_last(drv));
 
   // Let LVGL know that flushing is done
   lv_disp_flush_ready(drv);
-}
\ No newline at end of file
+}
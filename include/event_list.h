@@ -0,0 +1,133 @@
+#pragma once
+
+#include <time.h>
+
+#include "lvgl/lvgl.h"
+#include "events.h"
+
+// The home tile's event list. A fixed pool of single-line labels covers the
+// visible rows and is bound to the store by cursor; a row is only given new
+// text when what it shows changes, so scrolling costs the same for any
+// number of events. Render task only.
+
+#define EVENT_LIST_ROWS 12
+#define EVENT_LIST_TEXT 80
+
+struct EventList
+{
+  lv_obj_t *rows[EVENT_LIST_ROWS];
+  char shown[EVENT_LIST_ROWS][EVENT_LIST_TEXT];
+  int visible; // Rows that fit at the current spacing
+};
+
+void eventListCreate(EventList &list, lv_obj_t *parent)
+{
+  for (int i = 0; i < EVENT_LIST_ROWS; i++)
+  {
+    list.rows[i] = lv_label_create(parent);
+    lv_label_set_long_mode(list.rows[i], LV_LABEL_LONG_CLIP);
+    lv_obj_set_width(list.rows[i], lv_pct(100));
+    lv_label_set_text_static(list.rows[i], "");
+    list.shown[i][0] = 0;
+  }
+  list.visible = 0;
+}
+
+// Place the rows spacing apart below the top line, hiding the ones that do not fit
+void eventListLayout(EventList &list, int spacing, int height)
+{
+  list.visible = 0;
+  for (int i = 0; i < EVENT_LIST_ROWS; i++)
+  {
+    int y = spacing + i * spacing;
+    bool fits = y + spacing <= height;
+    lv_obj_set_pos(list.rows[i], 0, y);
+    if (fits)
+    {
+      lv_obj_remove_flag(list.rows[i], LV_OBJ_FLAG_HIDDEN);
+      list.visible++;
+    }
+    else
+    {
+      lv_obj_add_flag(list.rows[i], LV_OBJ_FLAG_HIDDEN);
+    }
+  }
+}
+
+// What the list scrolls through: the untimed events, then the timed ones from the first not over yet
+struct EventListRange
+{
+  uint32_t untimed;
+  uint32_t firstCurrent;
+  uint32_t length;
+};
+
+EventListRange eventListRange(const EventStore *events, int64_t now)
+{
+  EventListRange r = {};
+  if (events == nullptr)
+    return r;
+
+  const Event *list = eventStoreEvents(events);
+  r.untimed = eventStoreNext(events, EVENT_UNTIMED + 1);
+  r.firstCurrent = eventStoreNext(events, now - events->maxDuration);
+  if (r.firstCurrent < r.untimed)
+    r.firstCurrent = r.untimed;
+  while (r.firstCurrent < events->count && list[r.firstCurrent].end < now && list[r.firstCurrent].start < now)
+    r.firstCurrent++;
+
+  r.length = r.untimed + events->count - r.firstCurrent;
+  return r;
+}
+
+// Store index of the item'th entry of the range
+static inline uint32_t eventListIndex(const EventListRange &r, uint32_t item)
+{
+  return item < r.untimed ? item : r.firstCurrent + (item - r.untimed);
+}
+
+// Timed events show their start time, with the day when it is not today
+static void eventListFormat(const EventStore *events, const Event &e, int64_t now, char *buf, size_t size)
+{
+  const char *title = eventStoreString(events, e.title);
+  if (e.start == EVENT_UNTIMED)
+  {
+    strlcpy(buf, title, size);
+    return;
+  }
+
+  time_t start = e.start, today = now;
+  struct tm startTm, todayTm;
+  localtime_r(&start, &startTm);
+  localtime_r(&today, &todayTm);
+  bool sameDay = startTm.tm_yday == todayTm.tm_yday && startTm.tm_year == todayTm.tm_year;
+
+  size_t n = strftime(buf, size, sameDay ? "%H:%M " : "%a %d %H:%M ", &startTm);
+  strlcpy(buf + n, title, size - n);
+}
+
+// Show the events from cursor on. Returns how many rows were given new text.
+int eventListBind(EventList &list, const EventStore *events, int cursor, int64_t now)
+{
+  EventListRange r = eventListRange(events, now);
+  int updated = 0;
+
+  for (int i = 0; i < list.visible; i++)
+  {
+    char buf[EVENT_LIST_TEXT] = "";
+    uint32_t item = cursor + i;
+    if (item < r.length)
+    {
+      eventListFormat(events, eventStoreEvents(events)[eventListIndex(r, item)], now, buf, sizeof(buf));
+    }
+
+    if (strcmp(buf, list.shown[i]) != 0)
+    {
+      strcpy(list.shown[i], buf);
+      lv_label_set_text_static(list.rows[i], list.shown[i]);
+      updated++;
+    }
+  }
+
+  return updated;
+}
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+// Calendar events in one allocation: a header, the events sorted by start
+// time, a hash table for interning and the string bytes. Everything inside
+// is addressed by offset, so a store can be copied or saved as one blob.
+// A store is built by one task and then handed over whole; it is never
+// modified once eventStoreFinish() has run.
+
+#define EVENT_STORE_VERSION 1
+// Times of events from the config's plain string list, they keep their order
+#define EVENT_UNTIMED 0
+
+struct Event
+{
+  int64_t start; // Unix seconds, or EVENT_UNTIMED
+  int64_t end;
+  uint32_t title;    // Offset into the strings, 0 is ""
+  uint32_t location;
+};
+
+struct EventStore
+{
+  uint16_t version;
+  uint16_t headerSize;
+  uint32_t size; // Bytes of the whole block
+  uint32_t count;
+  uint32_t capacity;
+  uint32_t hashSize; // Power of two
+  uint32_t stringsUsed;
+  uint32_t stringsSize;
+  int64_t maxDuration; // Longest event, bounds the window search
+};
+
+static inline Event *eventStoreEvents(EventStore *s)
+{
+  return (Event *)((uint8_t *)s + sizeof(EventStore));
+}
+
+static inline const Event *eventStoreEvents(const EventStore *s)
+{
+  return (const Event *)((const uint8_t *)s + sizeof(EventStore));
+}
+
+static inline uint32_t *eventStoreHash(EventStore *s)
+{
+  return (uint32_t *)(eventStoreEvents(s) + s->capacity);
+}
+
+static inline char *eventStoreStrings(EventStore *s)
+{
+  return (char *)(eventStoreHash(s) + s->hashSize);
+}
+
+static inline const char *eventStoreStrings(const EventStore *s)
+{
+  return (const char *)((const uint32_t *)(eventStoreEvents(s) + s->capacity) + s->hashSize);
+}
+
+static inline const char *eventStoreString(const EventStore *s, uint32_t offset)
+{
+  return eventStoreStrings(s) + offset;
+}
+
+static uint32_t eventStoreHashSize(uint32_t capacity)
+{
+  uint32_t hashSize = 16;
+  while (hashSize < capacity * 2)
+    hashSize *= 2;
+  return hashSize;
+}
+
+static size_t eventStoreBytes(uint32_t capacity, uint32_t stringBytes)
+{
+  return sizeof(EventStore) + capacity * sizeof(Event) + eventStoreHashSize(capacity) * sizeof(uint32_t) + stringBytes + 1;
+}
+
+// Room for capacity events and stringBytes of distinct strings, nullptr if out of memory
+EventStore *eventStoreCreate(uint32_t capacity, uint32_t stringBytes)
+{
+  uint32_t hashSize = eventStoreHashSize(capacity);
+  size_t size = eventStoreBytes(capacity, stringBytes);
+  EventStore *s = (EventStore *)malloc(size);
+  if (s == nullptr)
+    return nullptr;
+
+  *s = {};
+  s->version = EVENT_STORE_VERSION;
+  s->headerSize = sizeof(EventStore);
+  s->size = size;
+  s->capacity = capacity;
+  s->hashSize = hashSize;
+  s->stringsSize = stringBytes + 1;
+  s->stringsUsed = 1;
+
+  // Offset 0 is the empty string and doubles as the empty hash slot
+  memset(eventStoreHash(s), 0, hashSize * sizeof(uint32_t));
+  eventStoreStrings(s)[0] = 0;
+  return s;
+}
+
+// Offset of str in the store, added if it is new. UINT32_MAX if the strings are full.
+static uint32_t eventStoreIntern(EventStore *s, const char *str, size_t len)
+{
+  if (len == 0)
+    return 0;
+
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+  {
+    hash = (hash ^ (uint8_t)str[i]) * 16777619u;
+  }
+
+  uint32_t *table = eventStoreHash(s);
+  char *strings = eventStoreStrings(s);
+  uint32_t mask = s->hashSize - 1;
+
+  for (uint32_t i = hash & mask;; i = (i + 1) & mask)
+  {
+    uint32_t offset = table[i];
+    if (offset == 0)
+    {
+      if (s->stringsUsed + len + 1 > s->stringsSize)
+        return UINT32_MAX;
+
+      offset = s->stringsUsed;
+      memcpy(strings + offset, str, len);
+      strings[offset + len] = 0;
+      s->stringsUsed += len + 1;
+      table[i] = offset;
+      return offset;
+    }
+
+    if (strncmp(strings + offset, str, len) == 0 && strings[offset + len] == 0)
+      return offset;
+  }
+}
+
+// False once the store is full
+bool eventStoreAdd(EventStore *s, int64_t start, int64_t end, const char *title, const char *location = "")
+{
+  if (s->count == s->capacity)
+    return false;
+
+  uint32_t t = eventStoreIntern(s, title, strlen(title));
+  uint32_t l = eventStoreIntern(s, location, strlen(location));
+  if (t == UINT32_MAX || l == UINT32_MAX)
+    return false;
+
+  if (end < start)
+    end = start;
+  if (end - start > s->maxDuration)
+    s->maxDuration = end - start;
+
+  eventStoreEvents(s)[s->count++] = {start, end, t, l};
+  return true;
+}
+
+// Sort by start time. Untimed events stay first, in the order they were added.
+void eventStoreFinish(EventStore *s)
+{
+  Event *events = eventStoreEvents(s);
+  std::stable_sort(events, events + s->count, [](const Event &a, const Event &b)
+                   { return a.start < b.start; });
+}
+
+// Index of the first event starting at or after t, count if there is none
+uint32_t eventStoreNext(const EventStore *s, int64_t t)
+{
+  const Event *events = eventStoreEvents(s);
+  return std::lower_bound(events, events + s->count, t, [](const Event &e, int64_t t)
+                          { return e.start < t; }) -
+         events;
+}
+
+// Calls fn(const Event &) for every timed event overlapping [from, to), in start order
+template <typename Fn>
+void eventStoreWindow(const EventStore *s, int64_t from, int64_t to, Fn fn)
+{
+  const Event *events = eventStoreEvents(s);
+  int64_t earliest = from - s->maxDuration;
+  for (uint32_t i = eventStoreNext(s, earliest > EVENT_UNTIMED ? earliest : EVENT_UNTIMED + 1); i < s->count && events[i].start < to; i++)
+  {
+    if (events[i].end > from || events[i].start >= from)
+      fn(events[i]);
+  }
+}
+
+// A tight copy for saving: the untimed events, then as many from first on as fit in maxBytes.
+// nullptr if none fit.
+EventStore *eventStoreCompact(const EventStore *s, uint32_t first, uint32_t maxBytes)
+{
+  const Event *events = eventStoreEvents(s);
+
+  uint32_t untimed = eventStoreNext(s, EVENT_UNTIMED + 1);
+  if (first < untimed)
+    first = untimed;
+
+  uint32_t n = 0, stringBytes = 0;
+  for (uint32_t i = untimed ? 0 : first; i < s->count; i = (i + 1 == untimed) ? first : i + 1)
+  {
+    uint32_t bytes = strlen(eventStoreString(s, events[i].title)) + 1 + strlen(eventStoreString(s, events[i].location)) + 1;
+    if (eventStoreBytes(n + 1, stringBytes + bytes) > maxBytes)
+      break;
+    n++;
+    stringBytes += bytes;
+  }
+
+  if (n == 0)
+    return nullptr;
+
+  EventStore *c = eventStoreCreate(n, stringBytes);
+  if (c == nullptr)
+    return nullptr;
+
+  for (uint32_t i = untimed ? 0 : first; c->count < n; i = (i + 1 == untimed) ? first : i + 1)
+  {
+    eventStoreAdd(c, events[i].start, events[i].end, eventStoreString(s, events[i].title), eventStoreString(s, events[i].location));
+  }
+  return c;
+}
+
+#define EVENT_MERGE_MAX 8
+
+// Merge n sorted stores (nullptr entries are skipped) into one new sorted
+// store. A timed event with the same start, end and title as one already
+// taken, e.g. a deadline in two feeds, is dropped.
+EventStore *eventStoreMerge(const EventStore *const *stores, int n)
+{
+  if (n > EVENT_MERGE_MAX)
+    n = EVENT_MERGE_MAX;
+
+  uint32_t count = 0, stringBytes = 0;
+  for (int k = 0; k < n; k++)
+  {
+    if (stores[k])
+    {
+      count += stores[k]->count;
+      stringBytes += stores[k]->stringsUsed;
+    }
+  }
+
+  EventStore *merged = eventStoreCreate(count, stringBytes);
+  if (merged == nullptr)
+    return nullptr;
+
+  Event *out = eventStoreEvents(merged);
+  uint32_t cursor[EVENT_MERGE_MAX] = {};
+
+  while (true)
+  {
+    // k is a handful of feeds, a linear pick beats a heap. Ties go to the earlier store.
+    int best = -1;
+    for (int k = 0; k < n; k++)
+    {
+      if (stores[k] && cursor[k] < stores[k]->count &&
+          (best < 0 || eventStoreEvents(stores[k])[cursor[k]].start < eventStoreEvents(stores[best])[cursor[best]].start))
+        best = k;
+    }
+    if (best < 0)
+      break;
+
+    const EventStore *s = stores[best];
+    const Event &e = eventStoreEvents(s)[cursor[best]++];
+    const char *title = eventStoreString(s, e.title);
+
+    bool duplicate = false;
+    for (int i = (int)merged->count - 1; e.start != EVENT_UNTIMED && i >= 0 && out[i].start == e.start; i--)
+    {
+      if (out[i].end == e.end && strcmp(eventStoreString(merged, out[i].title), title) == 0)
+      {
+        duplicate = true;
+        break;
+      }
+    }
+
+    if (!duplicate)
+      eventStoreAdd(merged, e.start, e.end, title, eventStoreString(s, e.location));
+  }
+
+  return merged;
+}
+
+// Check a blob read back from storage before using it as a store
+bool eventStoreValid(const EventStore *s, size_t size)
+{
+  if (size < sizeof(EventStore) || s->version != EVENT_STORE_VERSION || s->headerSize != sizeof(EventStore) || s->size != size)
+    return false;
+  if (s->count > s->capacity || (s->hashSize & (s->hashSize - 1)) != 0 || s->stringsUsed > s->stringsSize || s->stringsUsed == 0)
+    return false;
+  if (sizeof(EventStore) + (uint64_t)s->capacity * sizeof(Event) + (uint64_t)s->hashSize * sizeof(uint32_t) + s->stringsSize != size)
+    return false;
+
+  const Event *events = eventStoreEvents(s);
+  const char *strings = eventStoreStrings(s);
+  if (strings[s->stringsUsed - 1] != 0)
+    return false;
+  for (uint32_t i = 0; i < s->count; i++)
+  {
+    if (events[i].title >= s->stringsUsed || events[i].location >= s->stringsUsed)
+      return false;
+  }
+  return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <nvs.h>
+#include <nvs_flash.h>
+
+// The last image shown on the panel, kept in its own NVS partition so boot
+// can put it back up before LVGL, WiFi or the config are ready. It is
+// rewritten at most every FRAME_SAVE_PERIOD_US to spare the flash.
+
+#define FRAME_PARTITION "frame"
+#define FRAME_NAMESPACE "frame"
+#define FRAME_KEY "panel"
+#define FRAME_SAVE_PERIOD_US (10 * 60 * 1000000LL)
+
+nvs_handle_t frameCacheHandle = 0;
+int64_t frameCacheSavedUs = -FRAME_SAVE_PERIOD_US;
+
+static bool frameCacheOpen()
+{
+  if (frameCacheHandle)
+    return true;
+
+  esp_err_t err = nvs_flash_init_partition(FRAME_PARTITION);
+  if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
+  {
+    nvs_flash_erase_partition(FRAME_PARTITION);
+    err = nvs_flash_init_partition(FRAME_PARTITION);
+  }
+
+  if (err != ESP_OK || nvs_open_from_partition(FRAME_PARTITION, FRAME_NAMESPACE, NVS_READWRITE, &frameCacheHandle) != ESP_OK)
+  {
+    frameCacheHandle = 0;
+    return false;
+  }
+  return true;
+}
+
+// True if a frame of exactly size bytes was saved
+bool frameCacheLoad(uint8_t *frame, size_t size)
+{
+  if (!frameCacheOpen())
+    return false;
+
+  size_t len = size;
+  return nvs_get_blob(frameCacheHandle, FRAME_KEY, frame, &len) == ESP_OK && len == size;
+}
+
+// Save the frame unless the last save is too recent
+void frameCacheSave(const uint8_t *frame, size_t size, int64_t nowUs)
+{
+  if (nowUs - frameCacheSavedUs < FRAME_SAVE_PERIOD_US || !frameCacheOpen())
+    return;
+
+  frameCacheSavedUs = nowUs;
+  if (nvs_set_blob(frameCacheHandle, FRAME_KEY, frame, size) != ESP_OK || nvs_commit(frameCacheHandle) != ESP_OK)
+    printf("Failed saving frame\n");
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Flick recognition over the IMU stream, in fixed point. Gravity is tracked
+// by a slow low pass and removed, the rest is smoothed, and a gesture is a
+// single lobe over the threshold on the horizontal or forward axis that ends
+// within the window. Its confidence comes from how far the peak went, how
+// much it stood out from the other axis and whether the wrist rotated.
+
+enum Gesture : int32_t
+{
+  GESTURE_NONE = -1,
+  GESTURE_LEFT,
+  GESTURE_RIGHT,
+  GESTURE_FORWARD,
+  GESTURE_BACK,
+};
+
+// One accelerometer and gyro reading, raw sensor units
+struct MotionSample
+{
+  int16_t ax, ay, az;
+  int16_t gx, gy, gz;
+  int64_t us; // When it was taken
+};
+
+// Samples looked back over, and the longest lobe that still counts as a flick
+#define GESTURE_WINDOW 32
+// A lobe shorter than this is a knock
+#define GESTURE_MIN_SAMPLES 3
+// Gravity follows over 2^6 samples, the smoothing over 2^2
+#define GESTURE_GRAVITY_SHIFT 6
+#define GESTURE_LOWPASS_SHIFT 2
+// Gyro bias follows over 2^8 still samples
+#define GESTURE_BIAS_SHIFT 8
+// Summed gyro axes, about 30 and 5 deg/s at +-500 deg/s
+#define GESTURE_GYRO_MIN 2000
+#define GESTURE_GYRO_STILL 330
+
+struct GestureConfig
+{
+  int32_t threshold;     // Smoothed linear acceleration, raw units
+  int64_t refractoryUs;  // Ignore everything this long after a gesture
+  int32_t minConfidence; // Percent
+};
+
+struct GestureResult
+{
+  Gesture gesture;
+  int32_t confidence; // Percent
+  int64_t us;         // Sample that completed it
+};
+
+struct GestureRecognizer
+{
+  GestureConfig config;
+  bool primed;
+  int32_t gravity[3]; // Q8
+  int32_t gyroBias[3]; // Q8
+  int32_t filtered[2]; // Horizontal, forward
+
+  // Last GESTURE_WINDOW samples of filtered and gyro
+  int16_t window[GESTURE_WINDOW][2];
+  uint16_t windowGyro[GESTURE_WINDOW];
+  uint32_t head;
+
+  int lobeAxis; // -1 while idle
+  int lobeSign;
+  int lobeLength;
+  int32_t lobePeak;
+  bool settling; // A lobe ran too long, wait for both axes to calm down
+  int64_t quietUntil;
+
+  uint32_t samples;
+  uint32_t gestures;
+  uint32_t rejected;
+};
+
+void gestureInit(GestureRecognizer &r, const GestureConfig &config)
+{
+  r = {};
+  r.config = config;
+  r.lobeAxis = -1;
+}
+
+static inline int16_t gestureClamp(int32_t v)
+{
+  return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : (int16_t)v;
+}
+
+// The lobe on r.lobeAxis just fell back, decide whether it was a flick
+static GestureResult gestureClassify(GestureRecognizer &r, int64_t us)
+{
+  GestureResult result = {GESTURE_NONE, 0, us};
+  if (r.lobeLength < GESTURE_MIN_SAMPLES)
+  {
+    r.rejected++;
+    return result;
+  }
+
+  int other = 1 - r.lobeAxis;
+  int32_t otherPeak = 0, gyroPeak = 0;
+  for (int i = 0; i < r.lobeLength; i++)
+  {
+    uint32_t slot = (r.head - 1 - i) % GESTURE_WINDOW;
+    int32_t v = abs(r.window[slot][other]);
+    otherPeak = v > otherPeak ? v : otherPeak;
+    gyroPeak = r.windowGyro[slot] > gyroPeak ? r.windowGyro[slot] : gyroPeak;
+  }
+
+  // Q8: 128 at the threshold, full at twice; half to full for how much the axis dominated
+  int32_t strength = r.lobePeak * 128 / r.config.threshold;
+  strength = strength > 256 ? 256 : strength;
+  int32_t dominance = r.lobePeak * 256 / (r.lobePeak + otherPeak);
+  int32_t confidence = (strength * dominance * 100) >> 16;
+  // Linear bumps without a turn of the wrist are likely the wearer walking
+  if (gyroPeak < GESTURE_GYRO_MIN)
+    confidence /= 2;
+
+  if (confidence < r.config.minConfidence)
+  {
+    r.rejected++;
+    return result;
+  }
+
+  if (r.lobeAxis == 0)
+    result.gesture = r.lobeSign > 0 ? GESTURE_LEFT : GESTURE_RIGHT;
+  else
+    result.gesture = r.lobeSign > 0 ? GESTURE_FORWARD : GESTURE_BACK;
+  result.confidence = confidence;
+
+  r.gestures++;
+  r.quietUntil = us + r.config.refractoryUs;
+  return result;
+}
+
+// Feed one sample, in order. Returns the gesture it completed, if any.
+GestureResult gestureFeed(GestureRecognizer &r, const MotionSample &s)
+{
+  GestureResult none = {GESTURE_NONE, 0, s.us};
+  int32_t accel[3] = {s.ax, s.ay, s.az};
+  int32_t gyro[3] = {s.gx, s.gy, s.gz};
+  r.samples++;
+
+  if (!r.primed)
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      r.gravity[i] = accel[i] << 8;
+      r.gyroBias[i] = gyro[i] << 8;
+    }
+    r.primed = true;
+    return none;
+  }
+
+  // Horizontal is -z and forward is x, as the watch is worn
+  int32_t horiz = -(accel[2] - (r.gravity[2] >> 8));
+  int32_t forward = accel[0] - (r.gravity[0] >> 8);
+  r.filtered[0] += (horiz - r.filtered[0]) >> GESTURE_LOWPASS_SHIFT;
+  r.filtered[1] += (forward - r.filtered[1]) >> GESTURE_LOWPASS_SHIFT;
+
+  int32_t rotation = 0;
+  for (int i = 0; i < 3; i++)
+  {
+    rotation += abs(gyro[i] - (r.gyroBias[i] >> 8));
+  }
+
+  uint32_t slot = r.head++ % GESTURE_WINDOW;
+  r.window[slot][0] = gestureClamp(r.filtered[0]);
+  r.window[slot][1] = gestureClamp(r.filtered[1]);
+  r.windowGyro[slot] = rotation > UINT16_MAX ? UINT16_MAX : rotation;
+
+  // The baseline adapts, except under a lobe so the gesture is not absorbed into it
+  int32_t calm = r.config.threshold / 2;
+  bool still = rotation < GESTURE_GYRO_STILL && abs(r.filtered[0]) < calm / 2 && abs(r.filtered[1]) < calm / 2;
+  for (int i = 0; i < 3; i++)
+  {
+    if (r.lobeAxis < 0)
+      r.gravity[i] += ((accel[i] << 8) - r.gravity[i]) >> GESTURE_GRAVITY_SHIFT;
+    if (still)
+      r.gyroBias[i] += ((gyro[i] << 8) - r.gyroBias[i]) >> GESTURE_BIAS_SHIFT;
+  }
+
+  if (r.lobeAxis < 0)
+  {
+    if (r.settling)
+    {
+      r.settling = abs(r.filtered[0]) >= calm || abs(r.filtered[1]) >= calm;
+      return none;
+    }
+    if (s.us < r.quietUntil)
+      return none;
+
+    int axis = abs(r.filtered[0]) >= abs(r.filtered[1]) ? 0 : 1;
+    int32_t v = abs(r.filtered[axis]);
+    if (v > r.config.threshold)
+    {
+      r.lobeAxis = axis;
+      r.lobeSign = r.filtered[axis] > 0 ? 1 : -1;
+      r.lobeLength = 1;
+      r.lobePeak = v;
+    }
+    return none;
+  }
+
+  int32_t v = r.filtered[r.lobeAxis] * r.lobeSign;
+  r.lobeLength++;
+  r.lobePeak = v > r.lobePeak ? v : r.lobePeak;
+
+  if (v < calm)
+  {
+    GestureResult result = gestureClassify(r, s.us);
+    r.lobeAxis = -1;
+    return result;
+  }
+
+  // Held too long for a flick: a tilt, or the wearer moving
+  if (r.lobeLength >= GESTURE_WINDOW)
+  {
+    r.rejected++;
+    r.lobeAxis = -1;
+    r.settling = true;
+  }
+  return none;
+}
+
+// Traces are one sample per line: us,ax,ay,az,gx,gy,gz
+int gestureTraceFormat(const MotionSample &s, char *buf, size_t size)
+{
+  return snprintf(buf, size, "%lld,%d,%d,%d,%d,%d,%d\n", (long long)s.us, s.ax, s.ay, s.az, s.gx, s.gy, s.gz);
+}
+
+bool gestureTraceParse(const char *line, MotionSample &s)
+{
+  long long us;
+  int v[6];
+  if (sscanf(line, "%lld,%d,%d,%d,%d,%d,%d", &us, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 7)
+    return false;
+  s = {(int16_t)v[0], (int16_t)v[1], (int16_t)v[2], (int16_t)v[3], (int16_t)v[4], (int16_t)v[5], us};
+  return true;
+}
+
+// Run a recorded trace through r, calling fn(const GestureResult &) for every
+// gesture. Lines that are not samples are skipped. Returns the samples fed.
+template <typename Fn>
+uint32_t gestureReplay(GestureRecognizer &r, FILE *trace, Fn fn)
+{
+  char line[96];
+  uint32_t fed = 0;
+  MotionSample s;
+  while (fgets(line, sizeof(line), trace))
+  {
+    if (!gestureTraceParse(line, s))
+      continue;
+    fed++;
+    GestureResult result = gestureFeed(r, s);
+    if (result.gesture != GESTURE_NONE)
+      fn(result);
+  }
+  return fed;
+}
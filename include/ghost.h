@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "refresh.h"
+
+// Ghosting budget for partial refreshes. The panel is split into a grid of
+// regions; each one counts how many of its pixels actually changed colour and
+// the partial refreshes that changed a good share of them. A window that only
+// nudges a few pixels of a region, like a bar ticking once a second, adds its
+// flips but not a partial. Once a region is over budget it gets a clean
+// refresh, and if too many are over budget the whole panel does.
+
+#define GHOST_REGION_W 32 // Native pixels, multiple of 8
+#define GHOST_REGION_H 37
+#define GHOST_COLS (128 / GHOST_REGION_W)
+#define GHOST_ROWS (296 / GHOST_REGION_H)
+
+#define GHOST_MAX_PARTIALS 30
+// A partial changing fewer pixels of a region than this is not counted as one there
+#define GHOST_MIN_FLIPS (GHOST_REGION_W * GHOST_REGION_H / 8)
+// Every pixel of a region flipping about 16 times
+#define GHOST_MAX_FLIPS (GHOST_REGION_W * GHOST_REGION_H * 16)
+// Cleaning this many regions costs about as much as a full refresh
+#define GHOST_FULL_REGIONS (GHOST_COLS * GHOST_ROWS / 2)
+
+struct GhostRegion
+{
+  uint16_t partials;
+  uint32_t flips;
+};
+
+struct GhostTracker
+{
+  GhostRegion regions[GHOST_ROWS][GHOST_COLS];
+  uint32_t cleanRefreshes;
+  uint32_t fullRefreshes;
+};
+
+// Count the pixels of window r that differ between what the panel shows and
+// the frame about to be shown, and charge a partial refresh to each region
+// where enough of them do
+static void ghostAccount(GhostTracker &g, const uint8_t *shown, const uint8_t *frame, int widthBytes, const RefreshRect &r)
+{
+  int bx1 = r.x / 8, bx2 = (r.x + r.w - 1) / 8;
+  uint32_t flips[GHOST_ROWS][GHOST_COLS] = {};
+
+  for (int y = r.y; y < r.y + r.h; y++)
+  {
+    uint32_t *row = flips[y / GHOST_REGION_H];
+    const uint8_t *s = shown + y * widthBytes;
+    const uint8_t *f = frame + y * widthBytes;
+    for (int bx = bx1; bx <= bx2; bx++)
+    {
+      row[bx * 8 / GHOST_REGION_W] += __builtin_popcount(s[bx] ^ f[bx]);
+    }
+  }
+
+  for (int ry = r.y / GHOST_REGION_H; ry <= (r.y + r.h - 1) / GHOST_REGION_H; ry++)
+  {
+    for (int rx = bx1 * 8 / GHOST_REGION_W; rx <= bx2 * 8 / GHOST_REGION_W; rx++)
+    {
+      GhostRegion &region = g.regions[ry][rx];
+      region.flips += flips[ry][rx];
+      if (flips[ry][rx] >= GHOST_MIN_FLIPS)
+        region.partials++;
+    }
+  }
+}
+
+static inline bool ghostOverBudget(const GhostRegion &region)
+{
+  return region.partials >= GHOST_MAX_PARTIALS || region.flips >= GHOST_MAX_FLIPS;
+}
+
+// Queue every over-budget region into s, returns how many there were
+static int ghostCollect(const GhostTracker &g, RefreshScheduler &s)
+{
+  int over = 0;
+
+  for (int ry = 0; ry < GHOST_ROWS; ry++)
+  {
+    for (int rx = 0; rx < GHOST_COLS; rx++)
+    {
+      if (ghostOverBudget(g.regions[ry][rx]))
+      {
+        refreshAdd(s, {(int16_t)(rx * GHOST_REGION_W), (int16_t)(ry * GHOST_REGION_H), GHOST_REGION_W, GHOST_REGION_H});
+        over++;
+      }
+    }
+  }
+
+  return over;
+}
+
+// Forget the history of every region fully inside r
+static void ghostReset(GhostTracker &g, const RefreshRect &r)
+{
+  for (int ry = 0; ry < GHOST_ROWS; ry++)
+  {
+    for (int rx = 0; rx < GHOST_COLS; rx++)
+    {
+      int x = rx * GHOST_REGION_W, y = ry * GHOST_REGION_H;
+      if (x >= r.x && y >= r.y && x + GHOST_REGION_W <= r.x + r.w && y + GHOST_REGION_H <= r.y + r.h)
+        g.regions[ry][rx] = {};
+    }
+  }
+}
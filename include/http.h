@@ -1,19 +1,22 @@
+#include <stddef.h>
+
 #include <esp_http_server.h>
-#include <esp_http_client.h>
 #include <esp_log.h>
-#include <esp_tls.h>
-#include <esp_crt_bundle.h>
+#include <freertos/semphr.h>
 
 #include <ArduinoJson.h>
 
-#define MIN(a,b) (((a)<(b))?(a):(b))
-#define MAX(a,b) (((a)>(b))?(a):(b))
-#define ABS(a) fabsf(a)
+#include "tasks.h"
+#include "http_client.h"
+#include "metrics.h"
+#include "ring_log.h"
+
 #define TAG "http"
 
-void op(int shift, const char* text);
-void loadConfig();
-void loadCalendar();
+bool loadConfig();
+void loadSavedConfig();
+bool loadCalendar();
+void publishEvents();
 
 esp_err_t getHandler(httpd_req_t *req)
 {
@@ -27,57 +30,252 @@ esp_err_t getHandler(httpd_req_t *req)
 
 esp_err_t reloadHandler(httpd_req_t *req)
 {
-    const char resp[] = "Reloaded!";
+    int64_t start = esp_timer_get_time();
+
+    // The network task does the fetch, answer right away
+    const char *resp = postNet(NET_RELOAD) ? "Reloading" : "Reload already queued";
     httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
 
     printf("Req to URI %s\n", req->uri);
 
-    loadConfig();
-
+    latencyRecord(httpLatency, esp_timer_get_time() - start);
     return ESP_OK;
 }
 
-esp_err_t postHandler(httpd_req_t *req)
+// Reads a request body for ArduinoJson as it arrives, without buffering it whole
+struct HttpdReader
 {
-    char content[100];
-
-    size_t recv_size = MIN(req->content_len, sizeof(content));
-
-    int ret = httpd_req_recv(req, content, recv_size);
-    if (ret <= 0) {  /* 0 return value indicates connection closed */
-        /* Check if timeout occurred */
-        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
-            /* In case of timeout one can choose to retry calling
-             * httpd_req_recv(), but to keep it simple, here we
-             * respond with an HTTP 408 (Request Timeout) error */
-            httpd_resp_send_408(req);
+    httpd_req_t* req;
+    size_t remaining;
+    char buf[256];
+    size_t len = 0, pos = 0;
+    bool failed = false;
+
+    HttpdReader(httpd_req_t* req) : req(req), remaining(req->content_len) {}
+
+    bool fill()
+    {
+        if (pos < len) {
+            return true;
         }
-        /* In case of error, returning ESP_FAIL will
-         * ensure that the underlying socket is closed */
-        return ESP_FAIL;
+        if (remaining == 0 || failed) {
+            return false;
+        }
+
+        int ret;
+        int timeouts = 0;
+        do {
+            ret = httpd_req_recv(req, buf, MIN(remaining, sizeof(buf)));
+        } while (ret == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < 3);
+
+        if (ret <= 0) {
+            failed = true;
+            return false;
+        }
+        remaining -= ret;
+        len = ret;
+        pos = 0;
+        return true;
+    }
+
+    int read()
+    {
+        return fill() ? (uint8_t)buf[pos++] : -1;
+    }
+
+    size_t readBytes(char* out, size_t n)
+    {
+        size_t done = 0;
+        while (done < n && fill()) {
+            size_t chunk = MIN(n - done, len - pos);
+            memcpy(out + done, buf + pos, chunk);
+            pos += chunk;
+            done += chunk;
+        }
+        return done;
     }
+};
 
-    printf("Got POST %s\n", content);
+#define API_BATCH_MAX 256
+// What a request's JsonDocument may take: a full batch of the longest
+// command, {"gesture":"forward"}, with room to spare. Only what the parse
+// keeps counts, so a body can be padded or pretty-printed as it likes.
+#define API_DOC_MAX 16384
 
-    JsonDocument json;
+// Hands a JsonDocument at most limit bytes, after which the parse fails
+// with NoMemory. Each block carries its size in front of it.
+struct ApiAllocator : ArduinoJson::Allocator
+{
+    static constexpr size_t header = alignof(max_align_t) > sizeof(size_t) ? alignof(max_align_t) : sizeof(size_t);
+    size_t limit;
+    size_t used = 0;
 
-    // Read JSON packet
-    DeserializationError error = deserializeJson(json, content);
+    ApiAllocator(size_t limit) : limit(limit) {}
 
+    void* allocate(size_t size) override
+    {
+        return reallocate(nullptr, size);
+    }
+
+    void deallocate(void* ptr) override
+    {
+        if (ptr == nullptr) {
+            return;
+        }
+        char* block = (char*)ptr - header;
+        used -= *(size_t*)block;
+        free(block);
+    }
+
+    void* reallocate(void* ptr, size_t size) override
+    {
+        char* block = ptr ? (char*)ptr - header : nullptr;
+        size_t old = block ? *(size_t*)block : 0;
+        if (used - old + size > limit) {
+            return nullptr;
+        }
+
+        block = (char*)realloc(block, header + size);
+        if (block == nullptr) {
+            return nullptr;
+        }
+        used = used - old + size;
+        *(size_t*)block = size;
+        return block + header;
+    }
+};
+
+static bool apiGesture(const char* name, int32_t& gesture)
+{
+    static const char* const names[] = {"left", "right", "forward", "back"};
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            gesture = GESTURE_LEFT + i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// One command object, or an array of them:
+//   {"shift": 2}  {"gesture": "left"}  {"reload": true}
+// UI commands from one request are applied together in a single render pass.
+// Answers once they are queued, nothing here waits on the render or network task.
+esp_err_t postHandler(httpd_req_t *req)
+{
+    int64_t start = esp_timer_get_time();
+
+    HttpdReader body(req);
+    ApiAllocator allocator(API_DOC_MAX);
+    JsonDocument json(&allocator);
+    DeserializationError error = deserializeJson(json, body);
+    if (body.failed) {
+        // The connection went away, returning ESP_FAIL closes the socket
+        return ESP_FAIL;
+    }
+    if (error == DeserializationError::NoMemory) {
+        // Stopped at API_DOC_MAX, httpd discards the rest of the body
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Too many commands");
+        return ESP_OK;
+    }
     if (error) {
-        ESP_LOGE("", "deserializeJson() failed: %s", error.c_str());
+        ESP_LOGE(TAG, "deserializeJson() failed: %s", error.c_str());
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, error.c_str());
         return ESP_OK;
     }
 
-    auto shift = json["shift"].as<int32_t>();
-    const char* text = json["text"].as<const char*>();
-    op(shift, text);
+    JsonArrayConst list = json.as<JsonArrayConst>();
+    size_t count = list.isNull() ? 1 : list.size();
+    if (count > API_BATCH_MAX) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Too many commands");
+        return ESP_OK;
+    }
 
-    const char resp[] = "URI POST Response";
-    httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+    UiBatch* batch = (UiBatch*)malloc(sizeof(UiBatch) + count * sizeof(UiCommand));
+    if (batch == nullptr) {
+        return httpd_resp_send_500(req);
+    }
+    batch->count = 0;
+
+    int reloads = 0;
+    auto parse = [&](JsonVariantConst item) {
+        UiCommand& cmd = batch->commands[batch->count];
+        cmd = {UI_SHIFT, 0, nullptr, start};
+        if (!item["shift"].isNull()) {
+            cmd.value = item["shift"].as<int32_t>();
+            batch->count++;
+        } else if (item["gesture"].is<const char*>() && apiGesture(item["gesture"].as<const char*>(), cmd.value)) {
+            cmd.type = UI_GESTURE;
+            batch->count++;
+        } else if (item["reload"] == true) {
+            reloads++;
+        } else {
+            return false;
+        }
+        return true;
+    };
+
+    bool valid = true;
+    if (list.isNull()) {
+        valid = parse(json.as<JsonVariantConst>());
+    } else {
+        for (JsonVariantConst item : list) {
+            valid &= parse(item);
+        }
+    }
+
+    if (!valid) {
+        free(batch);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown command");
+        return ESP_OK;
+    }
+
+    bool queued = true;
+    if (batch->count) {
+        queued = postUiBatch(batch);
+    } else {
+        free(batch);
+    }
+    if (reloads) {
+        postNet(NET_RELOAD);
+    }
+
+    if (!queued) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_send(req, "UI busy, try again", HTTPD_RESP_USE_STRLEN);
+    } else {
+        httpd_resp_send(req, "Queued", HTTPD_RESP_USE_STRLEN);
+    }
+
+    latencyRecord(httpLatency, esp_timer_get_time() - start);
     return ESP_OK;
 }
 
+// Span histograms, see metrics.h
+esp_err_t metricsHandler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    metricsFormat([&](const char* line) {
+        httpd_resp_send_chunk(req, line, HTTPD_RESP_USE_STRLEN);
+    });
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// The last few KB of ringLog() output
+esp_err_t logHandler(httpd_req_t *req)
+{
+    char* text = (char*)malloc(RING_LOG_TAIL);
+    if (text == nullptr) {
+        return httpd_resp_send_500(req);
+    }
+
+    size_t len = ringLogCopy(text, RING_LOG_TAIL);
+    httpd_resp_set_type(req, "text/plain");
+    esp_err_t err = httpd_resp_send(req, text, len);
+    free(text);
+    return err;
+}
+
 /* URI handler structure for GET /uri */
 httpd_uri_t uri_get = {
     .uri      = "/api",
@@ -102,6 +300,20 @@ httpd_uri_t uri_post = {
     .user_ctx = NULL
 };
 
+httpd_uri_t uri_metrics = {
+    .uri      = "/metrics",
+    .method   = HTTP_GET,
+    .handler  = metricsHandler,
+    .user_ctx = NULL
+};
+
+httpd_uri_t uri_log = {
+    .uri      = "/log",
+    .method   = HTTP_GET,
+    .handler  = logHandler,
+    .user_ctx = NULL
+};
+
 /* Function for starting the webserver */
 httpd_handle_t start_webserver(void)
 {
@@ -117,6 +329,8 @@ httpd_handle_t start_webserver(void)
         httpd_register_uri_handler(server, &uri_get);
         httpd_register_uri_handler(server, &uri_reload);
         httpd_register_uri_handler(server, &uri_post);
+        httpd_register_uri_handler(server, &uri_metrics);
+        httpd_register_uri_handler(server, &uri_log);
     }
     /* If server failed to start, handle will be NULL */
     return server;
@@ -131,134 +345,32 @@ void stop_webserver(httpd_handle_t server)
     }
 }
 
-#define HTTP_RESP_SIZE 30000
-char httpResp[HTTP_RESP_SIZE];
-
-esp_err_t httpEventHandler(esp_http_client_event_t* evt)
+// Parses the body as JSON, keeping only the parts selected by filter, so
+// memory does not grow with the size of the response
+struct JsonSink : HttpSink
 {
-    static int output_len = 0;
-    static char* output_buffer = nullptr;
-
-    switch (evt->event_id) {
-    case HTTP_EVENT_ERROR:
-        ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
-        break;
-    case HTTP_EVENT_ON_CONNECTED:
-        ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
-        break;
-    case HTTP_EVENT_HEADER_SENT:
-        ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
-        break;
-    case HTTP_EVENT_ON_HEADER:
-        ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
-        break;
-    case HTTP_EVENT_ON_DATA: {
-        ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-
-            // Clean the buffer in case of a new request
-            if (output_len == 0) {
-                // we are just starting to copy the output data into the use
-                memset(httpResp, 0, HTTP_RESP_SIZE);
-                output_buffer = httpResp;
-            }
-            /*
-             *  Check for chunked encoding is added as the URL for chunked encoding used in this example returns binary data.
-             *  However, event handler can also be used in case chunked encoding is used.
-             */
-            if (!esp_http_client_is_chunked_response(evt->client)) {
-                // If user_data buffer is configured, copy the response into the buffer
-                int copy_len = 0;
-                // The last byte in httpResp is kept for the NULL character in case of out-of-bound access.
-                copy_len = MIN(evt->data_len, (HTTP_RESP_SIZE - output_len));
-                if (copy_len) {
-                    memcpy(httpResp + output_len, evt->data, copy_len);
-                }
-                output_len += copy_len;
-            }
-
-        break;
-    }
-    case HTTP_EVENT_ON_FINISH:
-        ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
-        output_len = 0;
-        break;
-    case HTTP_EVENT_DISCONNECTED: {
-        ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
-        int mbedtls_err = 0;
-        esp_err_t err = esp_tls_get_and_clear_last_error((esp_tls_error_handle_t)evt->data, &mbedtls_err, NULL);
-        if (err != 0) {
-            ESP_LOGI(TAG, "Last esp error code: 0x%x", err);
-            ESP_LOGI(TAG, "Last mbedtls failure: 0x%x", mbedtls_err);
+    JsonDocument& doc;
+    const JsonDocument& filter;
+
+    JsonSink(JsonDocument& doc, const JsonDocument& filter) : doc(doc), filter(filter) {}
+
+    esp_err_t consume(HttpStream& body) override
+    {
+        METRICS_SPAN(SPAN_JSON);
+        DeserializationError jerr = deserializeJson(doc, body, DeserializationOption::Filter(filter));
+        if (jerr) {
+            ESP_LOGE(TAG, "Failed deserializing json because %s", jerr.c_str());
+            return ESP_FAIL;
         }
-
-        break;
-    }
-    case HTTP_EVENT_REDIRECT:
-        ESP_LOGD(TAG, "HTTP_EVENT_REDIRECT");
-        esp_http_client_set_redirection(evt->client);
-        break;
+        return ESP_OK;
     }
-    return ESP_OK;
-}
+};
 
-esp_err_t getJsonFromPath(const char* host, const char* path, JsonDocument& doc)
+esp_err_t getJsonFromPath(const char* host, const char* path, JsonDocument& doc, const JsonDocument& filter, bool revalidate = false,
+                          HttpValidators* validators = nullptr)
 {
-    esp_http_client_config_t httpConfig = {};
-    httpConfig.host = host;
-    httpConfig.path = path;
-    httpConfig.transport_type = HTTP_TRANSPORT_OVER_SSL;
-    httpConfig.event_handler = httpEventHandler;
-    httpConfig.crt_bundle_attach = esp_crt_bundle_attach;
-
-    esp_http_client_handle_t client = esp_http_client_init(&httpConfig);
-
-    memset(httpResp, 0, sizeof(httpResp));
-    esp_err_t err = esp_http_client_perform(client);
-
-    if (err == ESP_OK) {
-        ESP_LOGI(TAG, "Successful HTTP request to %s, status %d, length %d", host, esp_http_client_get_status_code(client), (int)esp_http_client_get_content_length(client));
-    } else {
-        ESP_LOGE(TAG, "Failed HTTP request to %s", host);
-        esp_http_client_cleanup(client);
-        return err;
-    }
-
-    ESP_LOGI(TAG, "Parsing JSON %s", httpResp);
-    DeserializationError jerr = deserializeJson(doc, httpResp);
-
-    if (jerr) {
-        ESP_LOGE(TAG, "Failed deserializing json from %s because %s", host, "");
-        esp_http_client_cleanup(client);
-        return ESP_FAIL;
-    }
-
-    esp_http_client_cleanup(client);
-    return ESP_OK;
-}
-
-char* getFileFromPath(const char* host, const char* path) {
-    esp_http_client_config_t httpConfig = {};
-    httpConfig.host = host;
-    httpConfig.path = path;
-    httpConfig.transport_type = HTTP_TRANSPORT_OVER_SSL;
-    httpConfig.event_handler = httpEventHandler;
-    httpConfig.crt_bundle_attach = esp_crt_bundle_attach;
-
-    esp_http_client_handle_t client = esp_http_client_init(&httpConfig);
-
-    memset(httpResp, 0, sizeof(httpResp));
-    esp_err_t err = esp_http_client_perform(client);
-
-    if (err == ESP_OK) {
-        ESP_LOGI(TAG, "Successful HTTP request to %s, status %d, length %d", host, esp_http_client_get_status_code(client), (int)esp_http_client_get_content_length(client));
-    } else {
-        ESP_LOGE(TAG, "Failed HTTP request to %s", host);
-        esp_http_client_cleanup(client);
-        return nullptr;
-    }
-
-    esp_http_client_cleanup(client);
-    return httpResp;
+    JsonSink sink(doc, filter);
+    return httpFetch(host, path, sink, revalidate, validators);
 }
 
 #undef TAG
\ No newline at end of file
@@ -0,0 +1,469 @@
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_http_client.h>
+#include <esp_log.h>
+#include <esp_tls.h>
+#include <esp_crt_bundle.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "cache.h"
+#include "metrics.h"
+
+// The fetch side of http.h: kept-alive connections per host, conditional
+// requests against the validators kept in NVS, and bodies streamed into an
+// HttpSink. Nothing here needs ArduinoJson.
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+#define ABS(a) fabsf(a)
+#define TAG "http"
+
+#define HTTP_MAX_HOSTS 4
+
+// Define as "address:port" to send every fetch over plain HTTP to a local
+// stand-in server instead, as /<host><path>, e.g. to replay recorded feeds
+// with host/standin/standin_server.py. Any expression giving a string will do.
+// #define HTTP_STANDIN "192.168.1.2:8000"
+
+// Returned by httpFetch when a revalidated resource has not changed; the sink gets nothing
+#define HTTP_NOT_MODIFIED (ESP_ERR_HTTP_BASE + 0x80)
+
+// What the server said identifies the version we have, kept per URL in NVS
+// once the caller has accepted that version, see httpAccept()
+struct HttpValidators
+{
+    char etag[64];
+    char lastModified[32];
+};
+
+struct HttpStats
+{
+    uint32_t requests;
+    uint32_t handshakes;
+    int64_t handshakeUs;
+    int64_t ttfbUs;         // Request start to response headers, summed
+    int64_t lastTtfbUs;
+    uint32_t notModified;   // Requests answered with 304
+    uint64_t bodyBytes;     // Response bodies received
+};
+
+// One kept-alive client per host. A connection belongs to the fetch that
+// claimed it until httpRelease(), so only busy needs httpLock.
+struct HttpConnection
+{
+    char host[64];
+    esp_http_client_handle_t client;
+    uint32_t handshakes;    // New connections, each a TLS handshake (resumed if the server took our ticket)
+    int64_t handshakeUs;
+    int64_t openStartUs;    // Start of the request in flight
+    HttpValidators received; // From the headers of the response in flight
+    bool busy;              // Claimed by a fetch, guarded by httpLock
+    HttpStats stats;        // The fetch's own, added to httpStats on release
+};
+
+HttpConnection httpConnections[HTTP_MAX_HOSTS] = {};
+HttpStats httpStats = {}; // Guarded by httpLock, read it with httpStatsGet()
+SemaphoreHandle_t httpLock = nullptr;
+
+void httpInit()
+{
+    httpLock = xSemaphoreCreateMutex();
+}
+
+// Logging only, bodies are read through an HttpSink
+esp_err_t httpEventHandler(esp_http_client_event_t* evt)
+{
+    switch (evt->event_id) {
+    case HTTP_EVENT_ERROR:
+        ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
+        break;
+    case HTTP_EVENT_ON_CONNECTED: {
+        ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
+        // Only sent for new connections, once the handshake is through
+        HttpConnection* conn = (HttpConnection*)evt->user_data;
+        int64_t us = esp_timer_get_time() - conn->openStartUs;
+        conn->handshakes++;
+        conn->handshakeUs += us;
+        conn->stats.handshakes++;
+        conn->stats.handshakeUs += us;
+        metricsRecordUs(SPAN_HTTP_TLS, us);
+        ESP_LOGI(TAG, "Connected to %s in %d ms", conn->host, (int)(us / 1000));
+        break;
+    }
+    case HTTP_EVENT_HEADER_SENT:
+        ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
+        break;
+    case HTTP_EVENT_ON_HEADER: {
+        ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+        HttpValidators& received = ((HttpConnection*)evt->user_data)->received;
+        if (strcasecmp(evt->header_key, "ETag") == 0) {
+            strlcpy(received.etag, evt->header_value, sizeof(received.etag));
+        } else if (strcasecmp(evt->header_key, "Last-Modified") == 0) {
+            strlcpy(received.lastModified, evt->header_value, sizeof(received.lastModified));
+        }
+        break;
+    }
+    case HTTP_EVENT_ON_DATA:
+        ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
+        break;
+    case HTTP_EVENT_ON_FINISH:
+        ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
+        break;
+    case HTTP_EVENT_DISCONNECTED: {
+        ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
+        int mbedtls_err = 0;
+        esp_err_t err = esp_tls_get_and_clear_last_error((esp_tls_error_handle_t)evt->data, &mbedtls_err, NULL);
+        if (err != 0) {
+            ESP_LOGI(TAG, "Last esp error code: 0x%x", err);
+            ESP_LOGI(TAG, "Last mbedtls failure: 0x%x", mbedtls_err);
+        }
+
+        break;
+    }
+    case HTTP_EVENT_REDIRECT:
+        ESP_LOGD(TAG, "HTTP_EVENT_REDIRECT");
+        esp_http_client_set_redirection(evt->client);
+        break;
+    }
+    return ESP_OK;
+}
+
+#define HTTP_STREAM_BUF 512
+#define HTTP_MAX_REDIRECTS 3
+
+// Pulls a response body through a small buffer. esp_http_client_read() takes
+// care of chunked transfer encoding, so callers only ever see the payload.
+// Has the read() and readBytes() ArduinoJson expects of a reader.
+struct HttpStream
+{
+    esp_http_client_handle_t client;
+    char buf[HTTP_STREAM_BUF];
+    int len;
+    int pos;
+    size_t total;
+    bool failed;
+
+    bool fill()
+    {
+        len = esp_http_client_read(client, buf, sizeof(buf));
+        pos = 0;
+        if (len <= 0) {
+            failed |= len < 0;
+            len = 0;
+            return false;
+        }
+        total += len;
+        return true;
+    }
+
+    int peek()
+    {
+        if (pos == len && !fill()) {
+            return -1;
+        }
+        return (unsigned char)buf[pos];
+    }
+
+    int read()
+    {
+        if (pos == len && !fill()) {
+            return -1;
+        }
+        return (unsigned char)buf[pos++];
+    }
+
+    size_t readBytes(char* dst, size_t n)
+    {
+        size_t done = 0;
+        while (done < n) {
+            if (pos == len && !fill()) {
+                break;
+            }
+            size_t step = MIN(n - done, (size_t)(len - pos));
+            memcpy(dst + done, buf + pos, step);
+            pos += step;
+            done += step;
+        }
+        return done;
+    }
+};
+
+// Where a response body goes. A sink pulls the body through the stream as it
+// arrives, so a parser reads it in place and nothing holds the whole body.
+struct HttpSink
+{
+    virtual ~HttpSink() {}
+
+    virtual esp_err_t consume(HttpStream& body) = 0;
+};
+
+// Send the request and read the response headers, following redirects like
+// esp_http_client_perform() does. The body is then left to be read.
+esp_err_t httpOpen(esp_http_client_handle_t client, int& status)
+{
+    for (int redirects = 0; ; redirects++) {
+        esp_err_t err = esp_http_client_open(client, 0);
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        if (esp_http_client_fetch_headers(client) < 0) {
+            return ESP_FAIL;
+        }
+
+        status = esp_http_client_get_status_code(client);
+        bool redirect = status == 301 || status == 302 || status == 303 || status == 307 || status == 308;
+        if (!redirect || redirects == HTTP_MAX_REDIRECTS) {
+            return ESP_OK;
+        }
+
+        esp_http_client_flush_response(client, NULL);
+        esp_http_client_set_redirection(client);
+    }
+}
+
+// Mark a connection for host busy: an idle one to it, else an empty or
+// evicted slot. nullptr if every connection is in use. Needs httpLock.
+static HttpConnection* httpClaim(const char* host)
+{
+    HttpConnection* empty = nullptr;
+    HttpConnection* idle = nullptr;
+    for (HttpConnection& conn : httpConnections) {
+        if (conn.busy) {
+            continue;
+        }
+        if (conn.client && strcmp(conn.host, host) == 0) {
+            conn.busy = true;
+            return &conn;
+        }
+        if (!conn.client && !empty) {
+            empty = &conn;
+        }
+        if (conn.client && !idle) {
+            idle = &conn;
+        }
+    }
+
+    HttpConnection* slot = empty ? empty : idle;
+    if (slot == nullptr) {
+        return nullptr;
+    }
+
+    if (slot->client) {
+        // Out of slots: drop an idle host
+        esp_http_client_cleanup(slot->client);
+    }
+    *slot = {};
+    strlcpy(slot->host, host, sizeof(slot->host));
+    slot->busy = true;
+    return slot;
+}
+
+// An idle kept-alive client for host, created on first use. TLS session
+// tickets let reconnects skip most of the handshake. Concurrent fetches
+// from one host each get their own. Hand it back with httpRelease().
+HttpConnection* httpConnect(const char* host)
+{
+    HttpConnection* conn;
+    while (true) {
+        xSemaphoreTake(httpLock, portMAX_DELAY);
+        conn = httpClaim(host);
+        xSemaphoreGive(httpLock);
+
+        if (conn) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    if (conn->client) {
+        return conn;
+    }
+
+    esp_http_client_config_t httpConfig = {};
+    httpConfig.host = conn->host;
+    httpConfig.path = "/";
+#ifdef HTTP_STANDIN
+    char standin[96];
+    snprintf(standin, sizeof(standin), "http://%s/", HTTP_STANDIN);
+    httpConfig.url = standin;
+    httpConfig.transport_type = HTTP_TRANSPORT_OVER_TCP;
+#else
+    httpConfig.transport_type = HTTP_TRANSPORT_OVER_SSL;
+#endif
+    httpConfig.event_handler = httpEventHandler;
+    httpConfig.user_data = conn;
+    httpConfig.crt_bundle_attach = esp_crt_bundle_attach;
+    httpConfig.keep_alive_enable = true;
+    httpConfig.save_client_session = true;
+
+    conn->client = esp_http_client_init(&httpConfig);
+    return conn;
+}
+
+void httpRelease(HttpConnection* conn)
+{
+    const HttpStats& s = conn->stats;
+    xSemaphoreTake(httpLock, portMAX_DELAY);
+    httpStats.requests += s.requests;
+    httpStats.handshakes += s.handshakes;
+    httpStats.handshakeUs += s.handshakeUs;
+    httpStats.ttfbUs += s.ttfbUs;
+    if (s.lastTtfbUs) {
+        httpStats.lastTtfbUs = s.lastTtfbUs;
+    }
+    httpStats.notModified += s.notModified;
+    httpStats.bodyBytes += s.bodyBytes;
+    conn->stats = {};
+    conn->busy = false;
+    xSemaphoreGive(httpLock);
+}
+
+HttpStats httpStatsGet()
+{
+    xSemaphoreTake(httpLock, portMAX_DELAY);
+    HttpStats s = httpStats;
+    xSemaphoreGive(httpLock);
+    return s;
+}
+
+static void httpUrl(char* url, size_t size, const char* host, const char* path)
+{
+#ifdef HTTP_STANDIN
+    snprintf(url, size, "http://%s/%s%s", HTTP_STANDIN, host, path);
+#else
+    snprintf(url, size, "https://%s%s", host, path);
+#endif
+}
+
+// Ask only for a body newer than the one we fetched last time, if we have it
+static void httpSetConditional(esp_http_client_handle_t client, const char* url, bool revalidate)
+{
+    HttpValidators saved = {};
+    if (revalidate) {
+        cacheLoad(url, &saved, sizeof(saved));
+    }
+
+    if (saved.etag[0]) {
+        esp_http_client_set_header(client, "If-None-Match", saved.etag);
+    } else {
+        esp_http_client_delete_header(client, "If-None-Match");
+    }
+
+    if (saved.lastModified[0]) {
+        esp_http_client_set_header(client, "If-Modified-Since", saved.lastModified);
+    } else {
+        esp_http_client_delete_header(client, "If-Modified-Since");
+    }
+}
+
+static esp_err_t httpFetchOn(HttpConnection* conn, const char* host, const char* path, HttpSink& sink, bool revalidate)
+{
+    esp_http_client_handle_t client = conn->client;
+
+    char url[256];
+    httpUrl(url, sizeof(url), host, path);
+    esp_http_client_set_url(client, url);
+    httpSetConditional(client, url, revalidate);
+    conn->received = {};
+
+    conn->stats.requests++;
+    conn->openStartUs = esp_timer_get_time();
+    uint32_t handshakes = conn->handshakes;
+
+    int status = 0;
+    esp_err_t err = httpOpen(client, status);
+    if (err != ESP_OK && conn->handshakes == handshakes) {
+        // The server may have dropped the idle connection, try once on a new one
+        esp_http_client_close(client);
+        err = httpOpen(client, status);
+    }
+
+    int64_t ttfb = esp_timer_get_time() - conn->openStartUs;
+    metricsRecordUs(SPAN_HTTP_CONNECT, ttfb);
+
+    if (err == ESP_OK && status == 304) {
+        conn->stats.notModified++;
+        ESP_LOGI(TAG, "%s%s not modified, first byte after %d ms", host, path, (int)(ttfb / 1000));
+        esp_http_client_flush_response(client, NULL);
+        return HTTP_NOT_MODIFIED;
+    }
+
+    if (err == ESP_OK && status == 200) {
+        conn->stats.ttfbUs += ttfb;
+        conn->stats.lastTtfbUs = ttfb;
+        ESP_LOGI(TAG, "Successful HTTP request to %s%s, status %d, length %d%s, first byte after %d ms%s", host, path, status,
+                 (int)esp_http_client_get_content_length(client), esp_http_client_is_chunked_response(client) ? " (chunked)" : "",
+                 (int)(ttfb / 1000), conn->handshakes == handshakes ? " on a kept-alive connection" : "");
+    } else {
+        ESP_LOGE(TAG, "Failed HTTP request to %s%s, status %d", host, path, status);
+        esp_http_client_close(client);
+        return err == ESP_OK ? ESP_FAIL : err;
+    }
+
+    HttpStream stream = {};
+    stream.client = client;
+    int64_t bodyStart = esp_timer_get_time();
+    err = sink.consume(stream);
+    metricsRecordUs(SPAN_HTTP_BODY, esp_timer_get_time() - bodyStart);
+    if (err == ESP_OK && stream.failed) {
+        err = ESP_FAIL;
+    }
+
+    conn->stats.bodyBytes += stream.total;
+
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Received %d bytes from %s%s", (int)stream.total, host, path);
+        // Pull parsers can stop short of the end, the connection is only reusable once the body is read
+        if (!esp_http_client_is_complete_data_received(client)) {
+            esp_http_client_flush_response(client, NULL);
+        }
+    } else {
+        ESP_LOGE(TAG, "Failed reading %s%s after %d bytes", host, path, (int)stream.total);
+        esp_http_client_close(client);
+    }
+
+    return err;
+}
+
+// GET host/path over TLS and stream the body into sink as it arrives.
+// Sequential fetches from one host share a connection.
+// With revalidate the server can answer 304 instead, and HTTP_NOT_MODIFIED is returned.
+// Only pass it when the result of the previous accepted fetch is still at hand.
+// On success validators gets what identifies the body, for httpAccept().
+// Safe to call from several tasks at once.
+esp_err_t httpFetch(const char* host, const char* path, HttpSink& sink, bool revalidate = false, HttpValidators* validators = nullptr)
+{
+    HttpConnection* conn = httpConnect(host);
+    esp_err_t err = httpFetchOn(conn, host, path, sink, revalidate);
+    if (err == ESP_OK && validators) {
+        *validators = conn->received;
+    }
+    httpRelease(conn);
+    return err;
+}
+
+// The caller keeps the body it fetched with these validators, so a 304 can
+// stand in for it from now on. Not before: a 304 must never stand in for a
+// body that was rejected. A body without validators cannot be revalidated,
+// and whatever was kept for the URL before is dropped.
+void httpAccept(const char* host, const char* path, const HttpValidators& validators)
+{
+    char url[256];
+    httpUrl(url, sizeof(url), host, path);
+    if (validators.etag[0] || validators.lastModified[0]) {
+        cacheSave(url, &validators, sizeof(validators));
+    } else {
+        cacheErase(url);
+    }
+}
+
+#undef TAG
+
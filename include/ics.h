@@ -0,0 +1,135 @@
+#pragma once
+
+#include <uICAL.h>
+
+#include "events.h"
+#include "http_client.h"
+
+// ICS calendar feeds, parsed by uICAL straight off the connection. Only
+// events that can fall inside the requested window are kept while parsing,
+// and recurrences are only expanded inside it, so RAM does not grow with
+// the size or the history of the feed.
+
+// Upper bounds for one feed, the rest of the window is dropped
+#define ICS_MAX_EVENTS 256
+#define ICS_STRING_BYTES 8192
+
+#define TAG "ics"
+
+// uICAL reads its input through this interface
+class IcsStream : public uICAL::istream
+{
+public:
+    IcsStream(HttpStream& body) : body(body) {}
+
+    char peek() const override
+    {
+        int c = body.peek();
+        return c < 0 ? 0 : (char)c;
+    }
+
+    char get() override
+    {
+        int c = body.read();
+        return c < 0 ? 0 : (char)c;
+    }
+
+    bool readuntil(uICAL::string& st, char delim) override
+    {
+        st = "";
+        for (int c = body.read(); c >= 0; c = body.read()) {
+            if (c == delim) {
+                return true;
+            }
+            st += (char)c;
+        }
+        return st.length() > 0;
+    }
+
+private:
+    HttpStream& body;
+};
+
+// The places that depend on how uICAL represents time and recurrence
+static inline uICAL::DateTime icsTime(int64_t seconds)
+{
+    return uICAL::DateTime((uICAL::seconds_t)seconds);
+}
+
+static inline int64_t icsSeconds(const uICAL::DateTime& t)
+{
+    return t.epochtime.epochSeconds;
+}
+
+// uICAL leaves rrule empty for an event without an RRULE
+static inline bool icsRecurs(const uICAL::VEvent& event)
+{
+    return event.rrule != nullptr;
+}
+
+// Expands the feed over [from, to) into a new store
+struct IcsSink : HttpSink
+{
+    int64_t from, to;
+    EventStore* events = nullptr;
+
+    IcsSink(int64_t from, int64_t to) : from(from), to(to) {}
+
+    esp_err_t consume(HttpStream& body) override
+    {
+        events = eventStoreCreate(ICS_MAX_EVENTS, ICS_STRING_BYTES);
+        if (events == nullptr) {
+            return ESP_ERR_NO_MEM;
+        }
+
+        int kept = 0, skipped = 0;
+        try {
+            IcsStream ics(body);
+            int64_t until = to;
+
+            // Events starting after the window cannot recur into it, and single
+            // events that ended before it are history, so neither is stored
+            uICAL::Calendar_ptr cal = uICAL::Calendar::load(ics, [&](const uICAL::VEvent& event) {
+                bool keep = icsSeconds(event.start) < until && (icsRecurs(event) || icsSeconds(event.end) > from);
+                keep ? kept++ : skipped++;
+                return keep;
+            });
+
+            uICAL::CalendarIter_ptr it = uICAL::new_ptr<uICAL::CalendarIter>(cal, icsTime(from), icsTime(to));
+            while (it->next()) {
+                uICAL::CalendarEntry_ptr entry = it->current();
+                if (!eventStoreAdd(events, icsSeconds(entry->start()), icsSeconds(entry->end()), entry->summary().c_str())) {
+                    ESP_LOGW(TAG, "Calendar window truncated at %d events", (int)events->count);
+                    break;
+                }
+            }
+        } catch (uICAL::Error& e) {
+            ESP_LOGE(TAG, "Failed parsing calendar: %s", e.message.c_str());
+            free(events);
+            events = nullptr;
+            return ESP_FAIL;
+        }
+
+        eventStoreFinish(events);
+        ESP_LOGI(TAG, "Kept %d of %d calendar events, %d occurrences in the window", kept, kept + skipped, (int)events->count);
+        return ESP_OK;
+    }
+};
+
+// Fetch an ICS feed and expand it over [from, to). On success the caller owns events.
+esp_err_t getCalendarFromPath(const char* host, const char* path, int64_t from, int64_t to, EventStore*& events, bool revalidate = false)
+{
+    IcsSink sink(from, to);
+    HttpValidators validators;
+    esp_err_t err = httpFetch(host, path, sink, revalidate, &validators);
+    if (err != ESP_OK) {
+        free(sink.events);
+        sink.events = nullptr;
+    } else {
+        httpAccept(host, path, validators);
+    }
+    events = sink.events;
+    return err;
+}
+
+#undef TAG
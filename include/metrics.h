@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdio.h>
+#include <esp_cpu.h>
+
+// Where the time goes, for the /metrics endpoint. A span reads the CPU cycle
+// counter when it starts and ends and adds the difference to its span's
+// histogram of power-of-two buckets, all in fixed memory. Spans from several
+// tasks may race on the counters; an update lost to preemption is accepted
+// to keep a span at a few cycles. Set METRICS to 0 to compile them out.
+
+#ifndef METRICS
+#define METRICS 1
+#endif
+
+// Buckets are below 2^METRICS_MIN_BITS cycles, then one per power of two up to 2^31
+#define METRICS_MIN_BITS 10
+#define METRICS_BUCKETS (32 - METRICS_MIN_BITS + 1)
+#define METRICS_CPU_MHZ CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+
+enum MetricSpan : uint8_t
+{
+  SPAN_LVGL,         // lv_timer_handler()
+  SPAN_FLUSH,        // flush_cb's conversion into frameBuf
+  SPAN_SPI,          // One image write to the panel
+  SPAN_PANEL_BUSY,   // Waiting for the panel to finish a refresh
+  SPAN_HTTP_CONNECT, // Open to response headers, including TLS
+  SPAN_HTTP_TLS,     // Open to connected, when a handshake was needed
+  SPAN_HTTP_BODY,    // Reading and consuming the body
+  SPAN_JSON,         // Deserialising a streamed JSON body
+  SPAN_SENSOR,       // One FIFO drain of the MPU6050
+  SPAN_COUNT,
+};
+
+static const char *const metricSpanNames[SPAN_COUNT] = {
+    "lvgl", "flush", "spi", "panel_busy", "http_connect", "http_tls", "http_body", "json", "sensor"};
+
+struct MetricHistogram
+{
+  uint32_t buckets[METRICS_BUCKETS];
+  uint32_t count;
+  uint64_t sumCycles;
+  uint32_t maxCycles;
+};
+
+MetricHistogram metrics[SPAN_COUNT] = {};
+
+static inline uint32_t metricsNow()
+{
+  return esp_cpu_get_cycle_count();
+}
+
+static inline void metricsRecord(MetricSpan span, uint32_t cycles)
+{
+#if METRICS
+  int bits = cycles ? 32 - __builtin_clz(cycles) : 0;
+  int bucket = bits <= METRICS_MIN_BITS ? 0 : bits - METRICS_MIN_BITS;
+
+  MetricHistogram &h = metrics[span];
+  h.buckets[bucket]++;
+  h.count++;
+  h.sumCycles += cycles;
+  if (cycles > h.maxCycles)
+    h.maxCycles = cycles;
+#endif
+}
+
+// For spans measured with esp_timer across calls
+static inline void metricsRecordUs(MetricSpan span, int64_t us)
+{
+  int64_t cycles = us * METRICS_CPU_MHZ;
+  metricsRecord(span, cycles > UINT32_MAX ? UINT32_MAX : (uint32_t)cycles);
+}
+
+// Times the rest of the enclosing scope
+struct MetricScope
+{
+  MetricSpan span;
+  uint32_t start;
+
+  MetricScope(MetricSpan span) : span(span), start(metricsNow()) {}
+  ~MetricScope() { metricsRecord(span, metricsNow() - start); }
+};
+
+#if METRICS
+#define METRICS_CAT(a, b) a##b
+#define METRICS_NAME(line) METRICS_CAT(metricScope, line)
+#define METRICS_SPAN(span) MetricScope METRICS_NAME(__LINE__)(span)
+#else
+#define METRICS_SPAN(span)
+#endif
+
+// The histograms in Prometheus text format, one line at a time through emit(const char *line)
+template <typename Emit>
+void metricsFormat(Emit emit)
+{
+  char line[128];
+  emit("# HELP span_seconds Time spent in instrumented spans\n# TYPE span_seconds histogram\n");
+
+  for (int s = 0; s < SPAN_COUNT; s++)
+  {
+    const MetricHistogram &h = metrics[s];
+    uint32_t cumulative = 0;
+    for (int b = 0; b < METRICS_BUCKETS - 1; b++)
+    {
+      cumulative += h.buckets[b];
+      double le = (double)(1ull << (b + METRICS_MIN_BITS)) / (METRICS_CPU_MHZ * 1e6);
+      snprintf(line, sizeof(line), "span_seconds_bucket{span=\"%s\",le=\"%g\"} %lu\n", metricSpanNames[s], le, (unsigned long)cumulative);
+      emit(line);
+    }
+    snprintf(line, sizeof(line), "span_seconds_bucket{span=\"%s\",le=\"+Inf\"} %lu\n", metricSpanNames[s], (unsigned long)h.count);
+    emit(line);
+    snprintf(line, sizeof(line), "span_seconds_sum{span=\"%s\"} %.6f\nspan_seconds_count{span=\"%s\"} %lu\n",
+             metricSpanNames[s], h.sumCycles / (METRICS_CPU_MHZ * 1e6), metricSpanNames[s], (unsigned long)h.count);
+    emit(line);
+  }
+
+  emit("# HELP span_seconds_max Longest single span\n# TYPE span_seconds_max gauge\n");
+  for (int s = 0; s < SPAN_COUNT; s++)
+  {
+    snprintf(line, sizeof(line), "span_seconds_max{span=\"%s\"} %.6f\n", metricSpanNames[s], metrics[s].maxCycles / (METRICS_CPU_MHZ * 1e6));
+    emit(line);
+  }
+}
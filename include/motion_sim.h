@@ -0,0 +1,128 @@
+#pragma once
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "gesture.h"
+
+// A scripted stand-in for the MPU6050 when SENSOR_SIM is set. The script is
+// a list of flicks, L R F or B, each followed by how many ms of stillness
+// come after it, e.g. "F800 F800 B800 L2000"; it loops. Samples come at
+// MOTION_SIM_HZ with the watch flat and still in between.
+
+#define MOTION_SIM_HZ 100
+// A flick is a half sine over this many samples
+#define MOTION_SIM_FLICK 12
+// Peak of a flick, about 1 g at +-8 g, and the wrist turn with it, about 45 deg/s
+#define MOTION_SIM_ACCEL 4000
+#define MOTION_SIM_GYRO 3000
+#define MOTION_SIM_GRAVITY 4096
+
+struct MotionSim
+{
+  const char *script;
+  const char *next;
+  Gesture gesture; // Flick in progress
+  int flickSample;
+  int restSamples;
+  int64_t us;
+};
+
+void motionSimInit(MotionSim &sim, const char *script, int64_t startUs)
+{
+  sim = {};
+  sim.script = script;
+  sim.next = script;
+  sim.gesture = GESTURE_NONE;
+  sim.us = startUs;
+}
+
+// Read the next step of the script
+static void motionSimStep(MotionSim &sim)
+{
+  for (int tries = 0; tries < 2; tries++)
+  {
+    while (*sim.next && isspace((unsigned char)*sim.next))
+      sim.next++;
+    if (*sim.next)
+      break;
+    sim.next = sim.script;
+  }
+
+  switch (*sim.next)
+  {
+  case 'L':
+    sim.gesture = GESTURE_LEFT;
+    break;
+  case 'R':
+    sim.gesture = GESTURE_RIGHT;
+    break;
+  case 'F':
+    sim.gesture = GESTURE_FORWARD;
+    break;
+  case 'B':
+    sim.gesture = GESTURE_BACK;
+    break;
+  default:
+    sim.gesture = GESTURE_NONE;
+    break;
+  }
+  if (*sim.next)
+    sim.next++;
+
+  char *end;
+  long ms = strtol(sim.next, &end, 10);
+  sim.next = end;
+  sim.flickSample = 0;
+  sim.restSamples = ms > 0 ? ms * MOTION_SIM_HZ / 1000 : 1;
+}
+
+MotionSample motionSimNext(MotionSim &sim)
+{
+  MotionSample s = {0, 0, MOTION_SIM_GRAVITY, 0, 0, 0, sim.us};
+  sim.us += 1000000 / MOTION_SIM_HZ;
+
+  if (sim.gesture == GESTURE_NONE && sim.restSamples == 0)
+    motionSimStep(sim);
+
+  if (sim.gesture != GESTURE_NONE)
+  {
+    int16_t a = (int16_t)(MOTION_SIM_ACCEL * sin(M_PI * sim.flickSample / MOTION_SIM_FLICK));
+    switch (sim.gesture)
+    {
+    case GESTURE_LEFT:
+      s.az -= a;
+      s.gx = MOTION_SIM_GYRO;
+      break;
+    case GESTURE_RIGHT:
+      s.az += a;
+      s.gx = -MOTION_SIM_GYRO;
+      break;
+    case GESTURE_FORWARD:
+      s.ax += a;
+      s.gy = MOTION_SIM_GYRO;
+      break;
+    default:
+      s.ax -= a;
+      s.gy = -MOTION_SIM_GYRO;
+      break;
+    }
+
+    if (++sim.flickSample == MOTION_SIM_FLICK)
+      sim.gesture = GESTURE_NONE;
+    return s;
+  }
+
+  sim.restSamples--;
+  return s;
+}
+
+// Everything the MPU6050's FIFO would hold by nowUs, up to max samples, like mpuFifoDrain()
+int motionSimDrain(MotionSim &sim, MotionSample *batch, int max, int64_t nowUs)
+{
+  int n = 0;
+  while (n < max && sim.us <= nowUs)
+    batch[n++] = motionSimNext(sim);
+  return n;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <Wire.h>
+
+#include "gesture.h"
+#include "metrics.h"
+
+// MPU6050 FIFO sampling. Adafruit_MPU6050 only reads single samples, so the
+// FIFO, sample rate and interrupts are set up here at register level once
+// mpu.begin() has reset and woken the chip. Accelerometer and gyro go into
+// the FIFO, temperature does not. A motion interrupt says when there is
+// something to read.
+
+#define MPU_SDA 12
+#define MPU_SCL 11
+#define MPU_INT 13
+
+#define MPU_ADDR 0x68
+#define MPU_SAMPLE_HZ 100
+#define MPU_SAMPLE_BYTES 12
+// Whole samples per I2C read, within the Wire buffer
+#define MPU_READ_SAMPLES 10
+// How long the 1 KB FIFO takes to fill halfway
+#define MPU_FIFO_MS (1024 / MPU_SAMPLE_BYTES * 1000 / MPU_SAMPLE_HZ / 2)
+#define MPU_BATCH_MAX 64
+// +-8 g range
+#define MPU_LSB_PER_G 4096
+
+#define MPU_SMPLRT_DIV 0x19
+#define MPU_CONFIG 0x1A
+#define MPU_GYRO_CONFIG 0x1B
+#define MPU_ACCEL_CONFIG 0x1C
+#define MPU_MOT_THR 0x1F
+#define MPU_MOT_DUR 0x20
+#define MPU_FIFO_EN 0x23
+#define MPU_INT_PIN_CFG 0x37
+#define MPU_INT_ENABLE 0x38
+#define MPU_INT_STATUS 0x3A
+#define MPU_USER_CTRL 0x6A
+#define MPU_FIFO_COUNTH 0x72
+#define MPU_FIFO_R_W 0x74
+
+struct MotionStats
+{
+  uint32_t samples;
+  uint32_t batches;
+  uint32_t overflows;
+  uint32_t wakeups;
+};
+
+MotionStats motionStats = {};
+TaskHandle_t mpuTaskHandle = nullptr;
+
+static bool mpuWrite(TwoWire &wire, uint8_t reg, uint8_t val)
+{
+  wire.beginTransmission(MPU_ADDR);
+  wire.write(reg);
+  wire.write(val);
+  return wire.endTransmission() == 0;
+}
+
+static bool mpuRead(TwoWire &wire, uint8_t reg, uint8_t *buf, size_t len)
+{
+  wire.beginTransmission(MPU_ADDR);
+  wire.write(reg);
+  if (wire.endTransmission(false) != 0)
+    return false;
+
+  if (wire.requestFrom((uint8_t)MPU_ADDR, (uint8_t)len) != len)
+    return false;
+  for (size_t i = 0; i < len; i++)
+  {
+    buf[i] = wire.read();
+  }
+  return true;
+}
+
+// Call after mpu.begin() and setAccelerometerRange(MPU6050_RANGE_8_G)
+bool mpuFifoInit(TwoWire &wire)
+{
+  bool ok = true;
+  ok &= mpuWrite(wire, MPU_CONFIG, 0x03);                         // 44 Hz low pass, 1 kHz base rate
+  ok &= mpuWrite(wire, MPU_SMPLRT_DIV, 1000 / MPU_SAMPLE_HZ - 1);
+  ok &= mpuWrite(wire, MPU_GYRO_CONFIG, 0x08);                    // +-500 deg/s
+  ok &= mpuWrite(wire, MPU_ACCEL_CONFIG, 0x10 | 0x01);            // +-8 g, 5 Hz high pass for motion detection
+  ok &= mpuWrite(wire, MPU_MOT_THR, 10);                          // 20 mg
+  ok &= mpuWrite(wire, MPU_MOT_DUR, 1);                           // 1 ms
+  ok &= mpuWrite(wire, MPU_INT_PIN_CFG, 0x20 | 0x10);             // Latched until any register read
+  ok &= mpuWrite(wire, MPU_INT_ENABLE, 0x40 | 0x10);              // Motion, FIFO overflow
+  ok &= mpuWrite(wire, MPU_FIFO_EN, 0x08 | 0x70);                 // Accelerometer, gyro
+  ok &= mpuWrite(wire, MPU_USER_CTRL, 0x04);                      // Reset the FIFO
+  ok &= mpuWrite(wire, MPU_USER_CTRL, 0x40);                      // and enable it
+  return ok;
+}
+
+// Read everything queued in the FIFO into batch, returns the sample count.
+// Timestamps are spread back from now at the sample rate.
+int mpuFifoDrain(TwoWire &wire, MotionSample *batch, int max)
+{
+  METRICS_SPAN(SPAN_SENSOR);
+  uint8_t status = 0;
+  if (!mpuRead(wire, MPU_INT_STATUS, &status, 1))
+    return 0;
+  if (status & 0x10)
+  {
+    // Overflowed: the oldest samples are gone and the rest may be misaligned
+    motionStats.overflows++;
+    mpuWrite(wire, MPU_USER_CTRL, 0x04 | 0x40);
+    return 0;
+  }
+
+  uint8_t countBuf[2];
+  if (!mpuRead(wire, MPU_FIFO_COUNTH, countBuf, 2))
+    return 0;
+
+  int queued = ((countBuf[0] << 8) | countBuf[1]) / MPU_SAMPLE_BYTES;
+  int n = queued < max ? queued : max;
+  int64_t now = esp_timer_get_time();
+
+  uint8_t raw[MPU_READ_SAMPLES * MPU_SAMPLE_BYTES];
+  for (int done = 0; done < n;)
+  {
+    int chunk = (n - done < MPU_READ_SAMPLES) ? n - done : MPU_READ_SAMPLES;
+    if (!mpuRead(wire, MPU_FIFO_R_W, raw, chunk * MPU_SAMPLE_BYTES))
+      return done;
+
+    for (int i = 0; i < chunk; i++)
+    {
+      const uint8_t *p = raw + i * MPU_SAMPLE_BYTES;
+      MotionSample &s = batch[done + i];
+      s.ax = (int16_t)((p[0] << 8) | p[1]);
+      s.ay = (int16_t)((p[2] << 8) | p[3]);
+      s.az = (int16_t)((p[4] << 8) | p[5]);
+      s.gx = (int16_t)((p[6] << 8) | p[7]);
+      s.gy = (int16_t)((p[8] << 8) | p[9]);
+      s.gz = (int16_t)((p[10] << 8) | p[11]);
+      s.us = now - (int64_t)(queued - 1 - (done + i)) * 1000000 / MPU_SAMPLE_HZ;
+    }
+    done += chunk;
+  }
+
+  motionStats.samples += n;
+  motionStats.batches++;
+  return n;
+}
+
+static void IRAM_ATTR mpuIsr()
+{
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(mpuTaskHandle, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+// Wake the calling task on the INT pin
+void mpuFifoStart()
+{
+  mpuTaskHandle = xTaskGetCurrentTaskHandle();
+  pinMode(MPU_INT, INPUT);
+  attachInterrupt(MPU_INT, mpuIsr, RISING);
+}
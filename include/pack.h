@@ -0,0 +1,298 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Conversion of LVGL pixels into the panel's native 1bpp layout.
+// The GxEPD2_290_BS panel is natively 128 wide and 296 tall, stored MSB first
+// with white as a set bit, exactly like GxEPD2_BW keeps its own buffer.
+
+// Same cut-off as the old per-pixel loop: anything above is white
+#define PACK_THRESHOLD 127
+
+struct PackTarget
+{
+  uint8_t *buf;     // (width / 8) * height bytes, native orientation
+  int16_t width;    // Native width in pixels, multiple of 8
+  int16_t height;   // Native height in pixels
+  uint8_t rotation; // Same meaning as display.setRotation()
+};
+
+// Top bits of four L8 pixels (little endian word) as a nibble, first pixel in bit 3
+static inline uint32_t packNibble(uint32_t w)
+{
+  return (((w >> 7) & 0x01010101u) * 0x80402010u) >> 28;
+}
+
+// Eight L8 pixels to one MSB-first byte
+static inline uint8_t packByte(const uint8_t *px)
+{
+  uint32_t lo, hi;
+  memcpy(&lo, px, 4);
+  memcpy(&hi, px + 4, 4);
+  return (uint8_t)((packNibble(lo) << 4) | packNibble(hi));
+}
+
+static inline void packStore(uint8_t *dst, uint8_t val, uint8_t mask)
+{
+  *dst = (mask == 0xFF) ? val : (uint8_t)((*dst & ~mask) | (val & mask));
+}
+
+// Logical (rotated) window to native window, same as GxEPD2_BW::_rotate
+static inline void packRotateArea(const PackTarget &t, int16_t &x, int16_t &y, int16_t &w, int16_t &h)
+{
+  int16_t tmp;
+  switch (t.rotation)
+  {
+  case 1:
+    tmp = x; x = y; y = tmp;
+    tmp = w; w = h; h = tmp;
+    x = t.width - x - w;
+    break;
+  case 2:
+    x = t.width - x - w;
+    y = t.height - y - h;
+    break;
+  case 3:
+    tmp = x; x = y; y = tmp;
+    tmp = w; w = h; h = tmp;
+    y = t.height - y - h;
+    break;
+  }
+}
+
+// One native row span, whole bytes written directly once x is byte aligned
+static void packRowNative(uint8_t *row, int x1, int x2, const uint8_t *src)
+{
+  int x = x1;
+
+  if (x & 7)
+  {
+    uint8_t val = 0, mask = 0;
+    int byte = x >> 3;
+    for (; x <= x2 && (x & 7); x++, src++)
+    {
+      uint8_t bit = 0x80 >> (x & 7);
+      mask |= bit;
+      if (*src > PACK_THRESHOLD)
+        val |= bit;
+    }
+    packStore(&row[byte], val, mask);
+  }
+
+  for (; x + 7 <= x2; x += 8, src += 8)
+  {
+    row[x >> 3] = packByte(src);
+  }
+
+  if (x <= x2)
+  {
+    uint8_t val = 0, mask = 0;
+    int byte = x >> 3;
+    for (; x <= x2; x++, src++)
+    {
+      uint8_t bit = 0x80 >> (x & 7);
+      mask |= bit;
+      if (*src > PACK_THRESHOLD)
+        val |= bit;
+    }
+    packStore(&row[byte], val, mask);
+  }
+}
+
+// Rotation 1 maps logical (x, y) to native (width - 1 - y, x), so a logical
+// column is a native row and each native byte holds 8 logical rows, bit n
+// being row y0 + n. Four columns are gathered per word load.
+static void packRot1(const PackTarget &t, int x1, int y1, int x2, int y2, const uint8_t *src, uint32_t stride)
+{
+  const int widthBytes = t.width / 8;
+
+  for (int y0 = y1 & ~7; y0 <= y2; y0 += 8)
+  {
+    int rlo = (y1 > y0) ? y1 - y0 : 0;
+    int rhi = (y2 < y0 + 7) ? y2 - y0 : 7;
+    uint8_t mask = (uint8_t)((0xFF << rlo) & (0xFF >> (7 - rhi)));
+
+    uint8_t *dst = t.buf + x1 * widthBytes + (widthBytes - 1 - y0 / 8);
+    const uint8_t *rows = src + (y0 + rlo - y1) * stride;
+
+    int x = x1;
+    for (; x + 3 <= x2; x += 4)
+    {
+      const uint8_t *p = rows + (x - x1);
+      uint32_t acc = 0;
+      for (int r = rlo; r <= rhi; r++, p += stride)
+      {
+        uint32_t w;
+        memcpy(&w, p, 4);
+        acc |= ((w >> 7) & 0x01010101u) << r;
+      }
+
+      packStore(dst, (uint8_t)acc, mask);
+      dst += widthBytes;
+      packStore(dst, (uint8_t)(acc >> 8), mask);
+      dst += widthBytes;
+      packStore(dst, (uint8_t)(acc >> 16), mask);
+      dst += widthBytes;
+      packStore(dst, (uint8_t)(acc >> 24), mask);
+      dst += widthBytes;
+    }
+
+    for (; x <= x2; x++)
+    {
+      const uint8_t *p = rows + (x - x1);
+      uint8_t acc = 0;
+      for (int r = rlo; r <= rhi; r++, p += stride)
+      {
+        if (*p > PACK_THRESHOLD)
+          acc |= 1 << r;
+      }
+
+      packStore(dst, acc, mask);
+      dst += widthBytes;
+    }
+  }
+}
+
+// Any rotation, one pixel at a time
+static void packGeneric(const PackTarget &t, int x1, int y1, int x2, int y2, const uint8_t *src, uint32_t stride)
+{
+  const int widthBytes = t.width / 8;
+
+  for (int y = y1; y <= y2; y++)
+  {
+    const uint8_t *p = src + (y - y1) * stride;
+    for (int x = x1; x <= x2; x++, p++)
+    {
+      int nx = x, ny = y;
+      switch (t.rotation)
+      {
+      case 1: nx = t.width - 1 - y; ny = x; break;
+      case 2: nx = t.width - 1 - x; ny = t.height - 1 - y; break;
+      case 3: nx = y; ny = t.height - 1 - x; break;
+      }
+
+      uint8_t bit = 0x80 >> (nx & 7);
+      uint8_t *dst = t.buf + ny * widthBytes + (nx >> 3);
+      *dst = (*p > PACK_THRESHOLD) ? (*dst | bit) : (*dst & ~bit);
+    }
+  }
+}
+
+// 8x8 bit transpose: out[c] bit r = in[r] bit (7 - c) (Hacker's Delight 7-3)
+static inline void packTranspose8(const uint8_t *in, uint8_t *out)
+{
+  uint32_t x = ((uint32_t)in[7] << 24) | ((uint32_t)in[6] << 16) | ((uint32_t)in[5] << 8) | in[4];
+  uint32_t y = ((uint32_t)in[3] << 24) | ((uint32_t)in[2] << 16) | ((uint32_t)in[1] << 8) | in[0];
+  uint32_t t;
+
+  t = (x ^ (x >> 7)) & 0x00AA00AAu;
+  x = x ^ t ^ (t << 7);
+  t = (y ^ (y >> 7)) & 0x00AA00AAu;
+  y = y ^ t ^ (t << 7);
+
+  t = (x ^ (x >> 14)) & 0x0000CCCCu;
+  x = x ^ t ^ (t << 14);
+  t = (y ^ (y >> 14)) & 0x0000CCCCu;
+  y = y ^ t ^ (t << 14);
+
+  t = (x & 0xF0F0F0F0u) | ((y >> 4) & 0x0F0F0F0Fu);
+  y = ((x << 4) & 0xF0F0F0F0u) | (y & 0x0F0F0F0Fu);
+  x = t;
+
+  out[0] = x >> 24;
+  out[1] = x >> 16;
+  out[2] = x >> 8;
+  out[3] = x;
+  out[4] = y >> 24;
+  out[5] = y >> 16;
+  out[6] = y >> 8;
+  out[7] = y;
+}
+
+// Pack an L8 area given in logical coordinates (inclusive, like lv_area_t)
+static void packL8(const PackTarget &t, int x1, int y1, int x2, int y2, const uint8_t *src, uint32_t stride)
+{
+  switch (t.rotation)
+  {
+  case 0:
+    for (int y = y1; y <= y2; y++)
+    {
+      packRowNative(t.buf + y * (t.width / 8), x1, x2, src + (y - y1) * stride);
+    }
+    break;
+  case 1:
+    packRot1(t, x1, y1, x2, y2, src, stride);
+    break;
+  default:
+    packGeneric(t, x1, y1, x2, y2, src, stride);
+    break;
+  }
+}
+
+// I1 (LVGL 1bpp, MSB first, 1 = bright) area in logical coordinates, palette already skipped.
+// Rotation 1 turns every 8x8 block into 8 native bytes with one transpose.
+static void packI1(const PackTarget &t, int x1, int y1, int x2, int y2, const uint8_t *src, uint32_t stride)
+{
+  const int widthBytes = t.width / 8;
+
+  if (t.rotation == 1)
+  {
+    for (int y0 = y1 & ~7; y0 <= y2; y0 += 8)
+    {
+      int rlo = (y1 > y0) ? y1 - y0 : 0;
+      int rhi = (y2 < y0 + 7) ? y2 - y0 : 7;
+      uint8_t mask = (uint8_t)((0xFF << rlo) & (0xFF >> (7 - rhi)));
+      int b = widthBytes - 1 - y0 / 8;
+
+      for (int x = x1; x <= x2; x += 8)
+      {
+        const uint8_t *p = src + (x - x1) / 8;
+        uint8_t in[8] = {}, out[8];
+        for (int r = rlo; r <= rhi; r++)
+          in[r] = p[(y0 + r - y1) * stride];
+
+        packTranspose8(in, out);
+
+        int cols = (x2 - x + 1 < 8) ? x2 - x + 1 : 8;
+        uint8_t *dst = t.buf + x * widthBytes + b;
+        for (int c = 0; c < cols; c++, dst += widthBytes)
+          packStore(dst, out[c], mask);
+      }
+    }
+    return;
+  }
+
+  for (int y = y1; y <= y2; y++)
+  {
+    const uint8_t *p = src + (y - y1) * stride;
+
+    if (t.rotation == 0 && (x1 & 7) == 0)
+    {
+      uint8_t *row = t.buf + y * widthBytes + x1 / 8;
+      int bytes = (x2 - x1 + 1) / 8;
+      memcpy(row, p, bytes);
+      if ((x2 - x1 + 1) & 7)
+        packStore(row + bytes, p[bytes], (uint8_t)(0xFF << (8 - ((x2 - x1 + 1) & 7))));
+      continue;
+    }
+
+    for (int x = x1; x <= x2; x++)
+    {
+      int i = x - x1;
+      bool white = p[i >> 3] & (0x80 >> (i & 7));
+
+      int nx = x, ny = y;
+      switch (t.rotation)
+      {
+      case 1: nx = t.width - 1 - y; ny = x; break;
+      case 2: nx = t.width - 1 - x; ny = t.height - 1 - y; break;
+      case 3: nx = y; ny = t.height - 1 - x; break;
+      }
+
+      uint8_t bit = 0x80 >> (nx & 7);
+      uint8_t *dst = t.buf + ny * widthBytes + (nx >> 3);
+      *dst = white ? (*dst | bit) : (*dst & ~bit);
+    }
+  }
+}
@@ -0,0 +1,415 @@
+#pragma once
+
+#include <string.h>
+
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "pack.h"
+#include "refresh.h"
+#include "ghost.h"
+#include "frame_cache.h"
+#include "metrics.h"
+#include "ring_log.h"
+#include "tasks.h"
+
+// The panel task and what feeds it. flush_cb packs areas into frameBuf; the
+// panel task coalesces them, takes their content into panelBuf and refreshes
+// them through a PanelDriver, then spends the ghosting budget. A refresh
+// returns once BUSY drops: panelBusyCallback() sleeps on panelReady until
+// panelBusyIsr() gives it on the falling edge. display.h supplies the
+// GxEPD2 driver; with PANEL_SIM set the driver is panel_sim.h's, with a
+// timer firing the edge.
+
+// Set to drive a simulated panel instead of the real one, see panel_sim.h
+#ifndef PANEL_SIM
+#define PANEL_SIM 0
+#endif
+
+// DEPG0290BS, native orientation
+#define PANEL_WIDTH 128
+#define PANEL_HEIGHT 296
+
+// How long a wait for the BUSY edge lasts before BUSY is read again
+#define PANEL_BUSY_POLL_MS 50
+
+// What the panel task needs of the controller. Windows are in panel
+// coordinates and their image comes from panelBuf; refresh() and full()
+// return once BUSY is low again.
+struct PanelDriver
+{
+  // Send a window to the new (0x24) or previous (0x26) image
+  void (*write)(uint8_t command, int16_t x, int16_t y, int16_t w, int16_t h, bool invert);
+  void (*refresh)(int16_t x, int16_t y, int16_t w, int16_t h);
+  // Both images and a full refresh
+  void (*full)();
+  // Log the driver's own numbers after a pass that refreshed something
+  void (*report)();
+};
+
+PanelDriver panelDriver = {};
+
+// 1bpp frame in panel orientation, written by flush_cb
+uint8_t frameBuf[(PANEL_WIDTH / 8) * PANEL_HEIGHT];
+// The panel's copy: what it shows, or is about to show once the refresh in flight ends.
+// Only the panel task reads it, so LVGL can keep drawing into frameBuf meanwhile.
+// Word aligned so full-width windows can be sent by DMA straight from it.
+WORD_ALIGNED_ATTR uint8_t panelBuf[(PANEL_WIDTH / 8) * PANEL_HEIGHT];
+
+// Areas flushed since the panel task last picked them up
+RefreshScheduler refreshScheduler = {};
+GhostTracker ghostTracker = {};
+
+// Guards frameBuf and the pending list of refreshScheduler
+SemaphoreHandle_t frameLock = nullptr;
+// Given from the BUSY pin interrupt when the panel finishes a refresh
+SemaphoreHandle_t panelReady = nullptr;
+TaskHandle_t panelTaskHandle = nullptr;
+// Time since boot when the first refresh finished
+int64_t panelFirstPixelUs = 0;
+
+// Sensor times of gestures, timed to the end of the refresh that shows them.
+// Applied but not flushed yet: render task only. Flushed but not on the
+// panel yet: guarded by frameLock.
+#define PANEL_GESTURES 16
+int64_t gesturesApplied[PANEL_GESTURES];
+int gesturesAppliedCount = 0;
+int64_t gesturesFlushed[PANEL_GESTURES];
+int gesturesFlushedCount = 0;
+
+// Same sequence as GxEPD2_BW::displayWindow(), in panel coordinates
+void panelDisplayWindow(int16_t x, int16_t y, int16_t w, int16_t h)
+{
+  panelDriver.write(0x24, x, y, w, h, false);
+  panelDriver.refresh(x, y, w, h);
+
+  // The shown image becomes the previous one for the next differential refresh
+  panelDriver.write(0x26, x, y, w, h, false);
+}
+
+// Same sequence as GxEPD2_BW::display(), but from panelBuf
+void panelDisplay(bool partial_update_mode)
+{
+  if (partial_update_mode)
+    panelDisplayWindow(0, 0, PANEL_WIDTH, PANEL_HEIGHT);
+  else
+    panelDriver.full();
+}
+
+// Drive every pixel of the window to the opposite colour and back to clear ghosting
+void panelCleanWindow(int16_t x, int16_t y, int16_t w, int16_t h)
+{
+  panelDriver.write(0x24, x, y, w, h, true);
+  panelDriver.refresh(x, y, w, h);
+  panelDriver.write(0x26, x, y, w, h, true);
+
+  panelDisplayWindow(x, y, w, h);
+}
+
+// Take the window's new content from frameBuf, counting the pixels it flips.
+// False if nothing in it changed. Needs frameLock.
+bool panelSnapshot(const RefreshRect &r)
+{
+  bool changed = false;
+
+  for (int y = r.y; y < r.y + r.h; y++)
+  {
+    int offset = y * (PANEL_WIDTH / 8) + r.x / 8;
+    changed |= memcmp(panelBuf + offset, frameBuf + offset, (r.x + r.w + 7) / 8 - r.x / 8) != 0;
+  }
+
+  if (!changed)
+    return false;
+
+  ghostAccount(ghostTracker, panelBuf, frameBuf, PANEL_WIDTH / 8, r);
+
+  for (int y = r.y; y < r.y + r.h; y++)
+  {
+    int offset = y * (PANEL_WIDTH / 8) + r.x / 8;
+    memcpy(panelBuf + offset, frameBuf + offset, (r.x + r.w + 7) / 8 - r.x / 8);
+  }
+  return true;
+}
+
+// Full refresh, clears all ghosting
+void panelFullRefresh()
+{
+  RefreshRect all = {0, 0, PANEL_WIDTH, PANEL_HEIGHT};
+
+  xSemaphoreTake(frameLock, portMAX_DELAY);
+  memcpy(panelBuf, frameBuf, sizeof(panelBuf));
+  xSemaphoreGive(frameLock);
+
+  int64_t start = esp_timer_get_time();
+  panelDisplay(false);
+  int64_t end = esp_timer_get_time();
+  refreshRecord(refreshScheduler, end, end - start);
+  if (panelFirstPixelUs == 0)
+    panelFirstPixelUs = end;
+
+  ghostReset(ghostTracker, all);
+  ghostTracker.fullRefreshes++;
+}
+
+// Clean regions over their ghosting budget, or the whole panel if most are
+void panelCheckGhosting()
+{
+  RefreshScheduler dirty = {};
+  int over = ghostCollect(ghostTracker, dirty);
+
+  if (over == 0)
+    return;
+
+  if (over >= GHOST_FULL_REGIONS)
+  {
+    ringLog("Ghosting budget exceeded in %d regions, full refresh\n", over);
+    panelFullRefresh();
+    return;
+  }
+
+  int windows = refreshCoalesce(dirty);
+  for (int i = 0; i < windows; i++)
+  {
+    const RefreshRect &r = dirty.rects[i];
+    int64_t start = esp_timer_get_time();
+    panelCleanWindow(r.x, r.y, r.w, r.h);
+    int64_t end = esp_timer_get_time();
+    refreshRecord(refreshScheduler, end, end - start);
+
+    ghostReset(ghostTracker, r);
+    ghostTracker.cleanRefreshes++;
+  }
+
+  ringLog("Ghosting budget exceeded in %d regions, cleaned in %d windows\n", over, windows);
+}
+
+// Render task, when a gesture has been applied to the UI
+void panelGestureApplied(int64_t sensorUs)
+{
+  if (gesturesAppliedCount < PANEL_GESTURES)
+    gesturesApplied[gesturesAppliedCount++] = sensorUs;
+}
+
+// Render task, after lv_timer_handler(): gestures that drew nothing are done now
+void panelGesturesRendered()
+{
+  int64_t now = esp_timer_get_time();
+  for (int i = 0; i < gesturesAppliedCount; i++)
+  {
+    latencyRecord(gestureLatency, now - gesturesApplied[i]);
+  }
+  gesturesAppliedCount = 0;
+}
+
+// flush_cb's work on one area of the logical screen: pack it into frameBuf
+// and queue its window. The render's last area takes the gestures applied
+// before it along and hands the whole cycle to the panel task.
+void panelFlush(uint8_t rotation, int x1, int y1, int x2, int y2, const uint8_t *px, uint32_t stride, bool i1, bool last)
+{
+  int64_t start = esp_timer_get_time();
+
+  PackTarget panel = {frameBuf, PANEL_WIDTH, PANEL_HEIGHT, rotation};
+  int16_t x = x1, y = y1, w = x2 - x1 + 1, h = y2 - y1 + 1;
+  packRotateArea(panel, x, y, w, h);
+
+  xSemaphoreTake(frameLock, portMAX_DELAY);
+
+  uint32_t packStart = metricsNow();
+  if (i1)
+    packI1(panel, x1, y1, x2, y2, px, stride);
+  else
+    packL8(panel, x1, y1, x2, y2, px, stride);
+  metricsRecord(SPAN_FLUSH, metricsNow() - packStart);
+
+  refreshAdd(refreshScheduler, {x, y, w, h});
+
+  if (last)
+  {
+    for (int i = 0; i < gesturesAppliedCount && gesturesFlushedCount < PANEL_GESTURES; i++)
+    {
+      gesturesFlushed[gesturesFlushedCount++] = gesturesApplied[i];
+    }
+    gesturesAppliedCount = 0;
+  }
+
+  xSemaphoreGive(frameLock);
+
+  ringLog("Flushed %dx%d, packed in %d us\n", x2 - x1 + 1, y2 - y1 + 1, (int)(esp_timer_get_time() - start));
+
+  if (last)
+    xTaskNotifyGive(panelTaskHandle);
+}
+
+// Issue the merged refreshes for everything flushed since the last call
+void panelRefreshPending()
+{
+  RefreshRect windows[REFRESH_MAX_RECTS];
+  int64_t gestures[PANEL_GESTURES];
+
+  xSemaphoreTake(frameLock, portMAX_DELAY);
+  int areas = refreshScheduler.count;
+  int merged = refreshCoalesce(refreshScheduler);
+  int count = 0;
+  for (int i = 0; i < merged; i++)
+  {
+    // Redrawn but identical, e.g. the first render after a restored frame
+    if (panelSnapshot(refreshScheduler.rects[i]))
+      windows[count++] = refreshScheduler.rects[i];
+  }
+  refreshScheduler.count = 0;
+  int gestureCount = gesturesFlushedCount;
+  memcpy(gestures, gesturesFlushed, gestureCount * sizeof(int64_t));
+  gesturesFlushedCount = 0;
+  xSemaphoreGive(frameLock);
+
+  for (int i = 0; i < count; i++)
+  {
+    const RefreshRect &r = windows[i];
+    int64_t start = esp_timer_get_time();
+
+    if (r.w == PANEL_WIDTH && r.h == PANEL_HEIGHT)
+      panelDisplay(true);
+    else
+      panelDisplayWindow(r.x, r.y, r.w, r.h);
+
+    int64_t end = esp_timer_get_time();
+    refreshRecord(refreshScheduler, end, end - start);
+    if (panelFirstPixelUs == 0)
+      panelFirstPixelUs = end;
+  }
+
+  if (gestureCount)
+  {
+    int64_t shown = esp_timer_get_time();
+    for (int i = 0; i < gestureCount; i++)
+    {
+      latencyRecord(gestureLatency, shown - gestures[i]);
+    }
+    ringLog("Gesture to pixel latency avg %d us, max %d us; httpd response avg %d us\n",
+            latencyAverage(gestureLatency), (int)gestureLatency.maxUs, latencyAverage(httpLatency));
+  }
+
+  if (count == 0)
+    return;
+
+  const RefreshStats &st = refreshScheduler.stats;
+  ringLog("Refreshed %d areas in %d windows, %d refreshes last minute, %d ms busy\n",
+          areas, count, (int)st.lastMinute, (int)(st.lastMinuteBusyUs / 1000));
+  if (panelDriver.report)
+    panelDriver.report();
+
+  panelCheckGhosting();
+
+  frameCacheSave(panelBuf, sizeof(panelBuf), esp_timer_get_time());
+}
+
+// Put the last saved image back on the panel. Call after panelStart(), before LVGL renders.
+bool panelRestore()
+{
+  if (!frameCacheLoad(frameBuf, sizeof(frameBuf)))
+    return false;
+
+  // A full refresh, the panel may show anything after a reset
+  panelFullRefresh();
+  return true;
+}
+
+void IRAM_ATTR panelBusyIsr()
+{
+  BaseType_t woken = pdFALSE;
+  xSemaphoreGiveFromISR(panelReady, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+// Called by GxEPD2 while BUSY is asserted: sleep until the falling edge instead of polling.
+// The timeout only covers an edge that fired before we started waiting.
+void panelBusyCallback(const void *)
+{
+  xSemaphoreTake(panelReady, pdMS_TO_TICKS(PANEL_BUSY_POLL_MS));
+}
+
+// Owns the panel after startup; LVGL never waits for a refresh
+void panelTask(void *)
+{
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    panelRefreshPending();
+  }
+}
+
+// Call once the controller is ready for driver
+void panelStart(const PanelDriver &driver)
+{
+  panelDriver = driver;
+  frameLock = xSemaphoreCreateMutex();
+  panelReady = xSemaphoreCreateBinary();
+  xTaskCreate(panelTask, "panel", 4096, nullptr, 5, &panelTaskHandle);
+}
+
+#if PANEL_SIM
+#include "panel_sim.h"
+
+PanelSim<PANEL_WIDTH, PANEL_HEIGHT> panelSim = {};
+// The simulated BUSY pin is high until then; a timer stands in for its falling edge
+int64_t panelSimBusyUntilUs = 0;
+esp_timer_handle_t panelSimEdgeTimer = nullptr;
+// Set to lose the edges, so every refresh ends on PANEL_BUSY_POLL_MS timeouts
+bool panelSimMissEdges = false;
+
+static void panelSimEdge(void *)
+{
+  panelBusyIsr();
+}
+
+// Raise BUSY for busyUs and wait it out like GxEPD2's _waitWhileBusy()
+static void panelSimBusy(int64_t busyUs)
+{
+  panelSimBusyUntilUs = esp_timer_get_time() + busyUs;
+  if (!panelSimMissEdges)
+    esp_timer_start_once(panelSimEdgeTimer, busyUs);
+
+  while (esp_timer_get_time() < panelSimBusyUntilUs)
+    panelBusyCallback(nullptr);
+}
+
+static void panelSimDriverWrite(uint8_t command, int16_t x, int16_t y, int16_t w, int16_t h, bool invert)
+{
+  panelSimWrite(panelSim, command, panelBuf, x, y, w, h, invert);
+}
+
+static void panelSimDriverRefresh(int16_t x, int16_t y, int16_t w, int16_t h)
+{
+  panelSimBusy(panelSimRefresh(panelSim, x, y, w, h, false));
+}
+
+static void panelSimDriverFull()
+{
+  panelSimWrite(panelSim, 0x24, panelBuf, 0, 0, PANEL_WIDTH, PANEL_HEIGHT);
+  panelSimWrite(panelSim, 0x26, panelBuf, 0, 0, PANEL_WIDTH, PANEL_HEIGHT);
+  panelSimBusy(panelSimRefresh(panelSim, 0, 0, PANEL_WIDTH, PANEL_HEIGHT, true));
+}
+
+static void panelSimDriverReport()
+{
+  ringLog("Simulated panel: %d partial, %d full refreshes, %d KB written, %d ms busy in total\n",
+          (int)panelSim.partialRefreshes, (int)panelSim.fullRefreshes, (int)(panelSim.writeBytes / 1024), (int)(panelSim.busyUs / 1000));
+}
+
+// panelStart() with the simulated panel, which starts out white
+void panelSimStart()
+{
+  memset(panelSim.current, 0xFF, sizeof(panelSim.current));
+  memset(panelSim.previous, 0xFF, sizeof(panelSim.previous));
+
+  esp_timer_create_args_t edge = {};
+  edge.callback = panelSimEdge;
+  edge.name = "busy_edge";
+  esp_timer_create(&edge, &panelSimEdgeTimer);
+
+  panelStart({panelSimDriverWrite, panelSimDriverRefresh, panelSimDriverFull, panelSimDriverReport});
+}
+#endif
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <driver/spi_master.h>
+#include <driver/gpio.h>
+#include <esp_heap_caps.h>
+#include <esp_memory_utils.h>
+#include <esp_rom_gpio.h>
+#include <esp_timer.h>
+#include <soc/spi_periph.h>
+
+#include "metrics.h"
+
+// DMA transfer engine for the SSD1680's RAM writes.
+// GxEPD2 talks to the panel through Arduino's SPI on FSPI one byte at a time.
+// The bulk image data instead goes out over SPI3 with DMA: the SCK/MOSI pins
+// are switched to SPI3 in the GPIO matrix for the duration of a write and
+// handed back afterwards, so GxEPD2 keeps working for commands and refreshes.
+// Rows are gathered into one chunk while the previous chunk is being sent.
+
+// SSD1680 minimum write cycle is 50 ns
+#define PANEL_SPI_HZ 20000000
+#define PANEL_DMA_CHUNK 1024
+
+struct PanelDmaStats
+{
+  uint64_t bytes;            // Image bytes sent
+  uint64_t activeUs;         // Time from first chunk queued to last chunk done
+  uint64_t fillUs;           // Time spent gathering chunks
+  uint64_t overlappedFillUs; // Part of fillUs spent while a chunk was on the wire
+};
+
+struct PanelDma
+{
+  spi_device_handle_t dev;
+  uint8_t *chunk[2];
+  int sck, mosi, cs, dc;
+  PanelDmaStats stats;
+};
+
+PanelDma panelDma = {};
+
+static void panelDmaRoute(spi_host_device_t host)
+{
+  esp_rom_gpio_connect_out_signal(panelDma.sck, spi_periph_signal[host].spiclk_out, false, false);
+  esp_rom_gpio_connect_out_signal(panelDma.mosi, spi_periph_signal[host].spid_out, false, false);
+}
+
+esp_err_t panelDmaInit(int sck, int mosi, int cs, int dc)
+{
+  panelDma.sck = sck;
+  panelDma.mosi = mosi;
+  panelDma.cs = cs;
+  panelDma.dc = dc;
+
+  // Pins are routed by hand around each write, see panelDmaRoute()
+  spi_bus_config_t bus = {};
+  bus.mosi_io_num = -1;
+  bus.miso_io_num = -1;
+  bus.sclk_io_num = -1;
+  bus.quadwp_io_num = -1;
+  bus.quadhd_io_num = -1;
+  bus.max_transfer_sz = PANEL_DMA_CHUNK;
+
+  esp_err_t err = spi_bus_initialize(SPI3_HOST, &bus, SPI_DMA_CH_AUTO);
+  if (err != ESP_OK)
+    return err;
+
+  spi_device_interface_config_t devConfig = {};
+  devConfig.clock_speed_hz = PANEL_SPI_HZ;
+  devConfig.mode = 0;
+  devConfig.spics_io_num = -1; // CS is shared with GxEPD2, driven by hand
+  devConfig.queue_size = 2;
+
+  err = spi_bus_add_device(SPI3_HOST, &devConfig, &panelDma.dev);
+  if (err != ESP_OK)
+    return err;
+
+  for (int i = 0; i < 2; i++)
+  {
+    panelDma.chunk[i] = (uint8_t *)heap_caps_malloc(PANEL_DMA_CHUNK, MALLOC_CAP_DMA);
+    if (panelDma.chunk[i] == nullptr)
+      return ESP_ERR_NO_MEM;
+  }
+
+  return ESP_OK;
+}
+
+static void panelDmaSend(const uint8_t *data, size_t len)
+{
+  spi_transaction_t t = {};
+  t.length = len * 8;
+  if (len <= 4)
+  {
+    t.flags = SPI_TRANS_USE_TXDATA;
+    memcpy(t.tx_data, data, len);
+  }
+  else
+  {
+    t.tx_buffer = data;
+  }
+  spi_device_polling_transmit(panelDma.dev, &t);
+}
+
+static void panelDmaCommand(uint8_t cmd, const uint8_t *params, size_t len)
+{
+  gpio_set_level((gpio_num_t)panelDma.dc, 0);
+  panelDmaSend(&cmd, 1);
+  gpio_set_level((gpio_num_t)panelDma.dc, 1);
+  if (len)
+    panelDmaSend(params, len);
+}
+
+// Write a window of the native frame (x multiple of 8) into controller RAM.
+// cmd is 0x24 for the current image or 0x26 for the previous one.
+void panelDmaWrite(uint8_t cmd, const uint8_t *frame, int frameWidth, int16_t x, int16_t y, int16_t w, int16_t h, bool invert = false)
+{
+  METRICS_SPAN(SPAN_SPI);
+  const int frameBytes = frameWidth / 8;
+  const int bx = x / 8;
+  const int rowBytes = (x + w + 7) / 8 - bx;
+  const int rowsPerChunk = PANEL_DMA_CHUNK / rowBytes;
+  // Full-width rows are contiguous in the frame and can go out without a copy
+  const bool direct = !invert && rowBytes == frameBytes && esp_ptr_dma_capable(frame) && ((uintptr_t)frame & 3) == 0;
+
+  panelDmaRoute(SPI3_HOST);
+  gpio_set_level((gpio_num_t)panelDma.cs, 0);
+
+  // Same RAM window setup as GxEPD2_290_BS::_setPartialRamArea
+  uint8_t entry[] = {0x03};
+  uint8_t ramX[] = {(uint8_t)bx, (uint8_t)(bx + rowBytes - 1)};
+  uint8_t ramY[] = {(uint8_t)(y % 256), (uint8_t)(y / 256), (uint8_t)((y + h - 1) % 256), (uint8_t)((y + h - 1) / 256)};
+  uint8_t counterX[] = {(uint8_t)bx};
+  uint8_t counterY[] = {(uint8_t)(y % 256), (uint8_t)(y / 256)};
+  panelDmaCommand(0x11, entry, sizeof(entry));
+  panelDmaCommand(0x44, ramX, sizeof(ramX));
+  panelDmaCommand(0x45, ramY, sizeof(ramY));
+  panelDmaCommand(0x4e, counterX, sizeof(counterX));
+  panelDmaCommand(0x4f, counterY, sizeof(counterY));
+  panelDmaCommand(cmd, nullptr, 0);
+
+  spi_transaction_t trans[2] = {};
+  bool inFlight[2] = {};
+  int buf = 0;
+  int64_t start = esp_timer_get_time();
+
+  for (int row = y; row < y + h; row += rowsPerChunk)
+  {
+    int rows = (y + h - row < rowsPerChunk) ? y + h - row : rowsPerChunk;
+    int len = rows * rowBytes;
+    const uint8_t *src = frame + row * frameBytes + bx;
+
+    // Results come back in queue order, so this buffer's transfer is the older one
+    if (inFlight[buf])
+    {
+      spi_transaction_t *done;
+      spi_device_get_trans_result(panelDma.dev, &done, portMAX_DELAY);
+      inFlight[buf] = false;
+    }
+
+    if (direct)
+    {
+      trans[buf].tx_buffer = src;
+    }
+    else
+    {
+      int64_t fillStart = esp_timer_get_time();
+
+      uint8_t *dst = panelDma.chunk[buf];
+      for (int r = 0; r < rows; r++, src += frameBytes, dst += rowBytes)
+      {
+        if (invert)
+        {
+          for (int i = 0; i < rowBytes; i++)
+            dst[i] = ~src[i];
+        }
+        else
+        {
+          memcpy(dst, src, rowBytes);
+        }
+      }
+
+      int64_t fillTime = esp_timer_get_time() - fillStart;
+      panelDma.stats.fillUs += fillTime;
+      if (inFlight[buf ^ 1])
+        panelDma.stats.overlappedFillUs += fillTime;
+
+      trans[buf].tx_buffer = panelDma.chunk[buf];
+    }
+
+    trans[buf].length = len * 8;
+    spi_device_queue_trans(panelDma.dev, &trans[buf], portMAX_DELAY);
+    inFlight[buf] = true;
+    panelDma.stats.bytes += len;
+    buf ^= 1;
+  }
+
+  for (int i = 0; i < 2; i++)
+  {
+    if (inFlight[i])
+    {
+      spi_transaction_t *done;
+      spi_device_get_trans_result(panelDma.dev, &done, portMAX_DELAY);
+    }
+  }
+
+  panelDma.stats.activeUs += esp_timer_get_time() - start;
+
+  gpio_set_level((gpio_num_t)panelDma.cs, 1);
+  panelDmaRoute(SPI2_HOST);
+}
+
+// Bytes per second while transfers were running
+uint32_t panelDmaThroughput()
+{
+  return panelDma.stats.activeUs ? (uint32_t)(panelDma.stats.bytes * 1000000 / panelDma.stats.activeUs) : 0;
+}
+
+// Share of chunk gathering that happened while the previous chunk was on the wire, in percent
+int panelDmaOverlap()
+{
+  return panelDma.stats.fillUs ? (int)(panelDma.stats.overlappedFillUs * 100 / panelDma.stats.fillUs) : 0;
+}
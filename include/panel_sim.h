@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// A stand-in for the SSD1680 when PANEL_SIM is set: it keeps the
+// controller's two image RAMs, records every refresh and says how long a
+// real one keeps BUSY asserted; panel.h holds BUSY high that long. Frame
+// cost, refresh counts and busy time can then be measured with no panel
+// attached.
+
+#define PANEL_SIM_LOG 32
+// Typical BUSY times of the DEPG0290BS
+#define PANEL_SIM_PARTIAL_US 300000
+#define PANEL_SIM_FULL_US 1800000
+
+struct PanelSimRefresh
+{
+  int16_t x, y, w, h;
+  bool full;
+  int64_t busyUs;
+};
+
+template <int Width, int Height>
+struct PanelSim
+{
+  // 0x24 is the new image, 0x26 the previous one for differential refreshes
+  uint8_t current[(Width / 8) * Height];
+  uint8_t previous[(Width / 8) * Height];
+
+  uint32_t writes;
+  uint32_t writeBytes;
+  uint32_t partialRefreshes;
+  uint32_t fullRefreshes;
+  int64_t busyUs; // Simulated, summed over all refreshes
+
+  // Last PANEL_SIM_LOG refreshes, oldest overwritten
+  PanelSimRefresh log[PANEL_SIM_LOG];
+  uint32_t logged;
+};
+
+// Write a window of a full-width 1bpp frame into one of the RAMs, like a 0x24/0x26 command
+template <int Width, int Height>
+void panelSimWrite(PanelSim<Width, Height> &sim, uint8_t command, const uint8_t *frame, int16_t x, int16_t y, int16_t w, int16_t h, bool invert = false)
+{
+  uint8_t *ram = command == 0x26 ? sim.previous : sim.current;
+  int first = x / 8, bytes = (x + w + 7) / 8 - x / 8;
+
+  for (int row = y; row < y + h; row++)
+  {
+    int offset = row * (Width / 8) + first;
+    for (int i = 0; i < bytes; i++)
+    {
+      ram[offset + i] = invert ? ~frame[offset + i] : frame[offset + i];
+    }
+  }
+
+  sim.writes++;
+  sim.writeBytes += bytes * h;
+}
+
+// Record a refresh of the window and return how long the panel would be busy
+template <int Width, int Height>
+int64_t panelSimRefresh(PanelSim<Width, Height> &sim, int16_t x, int16_t y, int16_t w, int16_t h, bool full)
+{
+  int64_t busy = full ? PANEL_SIM_FULL_US : PANEL_SIM_PARTIAL_US;
+  full ? sim.fullRefreshes++ : sim.partialRefreshes++;
+  sim.busyUs += busy;
+  sim.log[sim.logged++ % PANEL_SIM_LOG] = {x, y, w, h, full, busy};
+  return busy;
+}
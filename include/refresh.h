@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stdint.h>
+
+// Collects the areas flushed during one LVGL render cycle and merges them
+// into as few panel refreshes as the cost model allows. Rectangles are in
+// native panel coordinates.
+
+#define REFRESH_MAX_RECTS 16
+
+// A partial refresh on the SSD1680 costs a fixed waveform time no matter the
+// window size, plus the bytes written (twice, current and previous RAM).
+#define REFRESH_COST_FIXED_US 300000
+#define REFRESH_COST_BYTE_US 8
+
+struct RefreshRect
+{
+  int16_t x, y, w, h;
+};
+
+struct RefreshStats
+{
+  uint32_t refreshes;     // Panel refreshes issued since boot
+  uint32_t areas;         // Areas flushed by LVGL since boot
+  uint64_t busyUs;        // Time spent in panel refreshes since boot
+  uint32_t lastMinute;    // Refreshes during the previous full minute
+  uint64_t lastMinuteBusyUs;
+  uint32_t thisMinute;
+  uint64_t thisMinuteBusyUs;
+  int64_t minuteStartUs;
+};
+
+struct RefreshScheduler
+{
+  RefreshRect rects[REFRESH_MAX_RECTS];
+  int count;
+  RefreshStats stats;
+};
+
+static inline RefreshRect refreshUnion(const RefreshRect &a, const RefreshRect &b)
+{
+  int16_t x1 = a.x < b.x ? a.x : b.x;
+  int16_t y1 = a.y < b.y ? a.y : b.y;
+  int16_t x2 = (a.x + a.w > b.x + b.w) ? a.x + a.w : b.x + b.w;
+  int16_t y2 = (a.y + a.h > b.y + b.h) ? a.y + a.h : b.y + b.h;
+  return {x1, y1, (int16_t)(x2 - x1), (int16_t)(y2 - y1)};
+}
+
+static inline int32_t refreshCost(const RefreshRect &r)
+{
+  // Windows are sent in whole bytes
+  int32_t bytes = ((r.x + r.w + 7) / 8 - r.x / 8) * r.h;
+  return REFRESH_COST_FIXED_US + bytes * REFRESH_COST_BYTE_US;
+}
+
+// Merge the pair that saves the most, as long as merging saves anything
+static bool refreshMergeBest(RefreshScheduler &s)
+{
+  int bestI = -1, bestJ = -1;
+  int32_t bestSaving = -1;
+
+  for (int i = 0; i < s.count; i++)
+  {
+    for (int j = i + 1; j < s.count; j++)
+    {
+      int32_t saving = refreshCost(s.rects[i]) + refreshCost(s.rects[j]) - refreshCost(refreshUnion(s.rects[i], s.rects[j]));
+      if (saving > bestSaving)
+      {
+        bestSaving = saving;
+        bestI = i;
+        bestJ = j;
+      }
+    }
+  }
+
+  if (bestI < 0 || bestSaving < 0)
+    return false;
+
+  s.rects[bestI] = refreshUnion(s.rects[bestI], s.rects[bestJ]);
+  s.rects[bestJ] = s.rects[--s.count];
+  return true;
+}
+
+static void refreshAdd(RefreshScheduler &s, RefreshRect r)
+{
+  s.stats.areas++;
+
+  // Drop areas already covered by a pending one
+  for (int i = 0; i < s.count; i++)
+  {
+    const RefreshRect &p = s.rects[i];
+    if (r.x >= p.x && r.y >= p.y && r.x + r.w <= p.x + p.w && r.y + r.h <= p.y + p.h)
+      return;
+  }
+
+  if (s.count == REFRESH_MAX_RECTS)
+  {
+    // Out of slots: fold the new area into whichever pending one grows least
+    int best = 0;
+    int32_t bestGrowth = INT32_MAX;
+    for (int i = 0; i < s.count; i++)
+    {
+      int32_t growth = refreshCost(refreshUnion(s.rects[i], r)) - refreshCost(s.rects[i]);
+      if (growth < bestGrowth)
+      {
+        bestGrowth = growth;
+        best = i;
+      }
+    }
+    s.rects[best] = refreshUnion(s.rects[best], r);
+    return;
+  }
+
+  s.rects[s.count++] = r;
+}
+
+// Reduce the pending list to the cheapest set of windows, returns how many
+static int refreshCoalesce(RefreshScheduler &s)
+{
+  while (s.count > 1 && refreshMergeBest(s))
+  {
+  }
+  return s.count;
+}
+
+// Account one panel refresh that kept the panel busy for busyUs
+static void refreshRecord(RefreshScheduler &s, int64_t nowUs, int64_t busyUs)
+{
+  RefreshStats &st = s.stats;
+
+  if (nowUs - st.minuteStartUs >= 60000000)
+  {
+    // Roll the window, an idle minute in between reads as zero
+    bool consecutive = nowUs - st.minuteStartUs < 120000000;
+    st.lastMinute = consecutive ? st.thisMinute : 0;
+    st.lastMinuteBusyUs = consecutive ? st.thisMinuteBusyUs : 0;
+    st.thisMinute = 0;
+    st.thisMinuteBusyUs = 0;
+    st.minuteStartUs = nowUs;
+  }
+
+  st.refreshes++;
+  st.busyUs += busyUs;
+  st.thisMinute++;
+  st.thisMinuteBusyUs += busyUs;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_timer.h>
+
+// Logging for the hot paths. ringLog() only stores the format string's
+// address and the raw arguments in a lock-free ring; the log task formats
+// them later at low priority, prints them and keeps the text of the last
+// few KB for GET /log. A full ring drops the entry and counts it, a caller
+// never waits. Safe from any task and from ISRs.
+// Arguments must be integers up to 32 bits, or strings that outlive the entry
+// (literals); there is no floating point. Call ringLogStart() before the
+// first entry.
+
+#define RING_LOG_ENTRIES 64 // Power of two
+#define RING_LOG_ARGS 6
+#define RING_LOG_TAIL 4096
+#define RING_LOG_PERIOD_MS 50
+
+struct RingLogEntry
+{
+  std::atomic<uint32_t> seq; // Vyukov's bounded queue: whose turn the slot is
+  const char *fmt;
+  uint32_t ms;
+  uintptr_t args[RING_LOG_ARGS];
+};
+
+RingLogEntry ringLogEntries[RING_LOG_ENTRIES];
+std::atomic<uint32_t> ringLogHead(0);
+uint32_t ringLogTail = 0; // Log task only
+std::atomic<uint32_t> ringLogDropped(0);
+
+// Formatted text for /log, oldest overwritten, guarded by ringLogTextLock
+char ringLogText[RING_LOG_TAIL];
+uint32_t ringLogTextEnd = 0;
+SemaphoreHandle_t ringLogTextLock = nullptr;
+TaskHandle_t ringLogTask = nullptr;
+
+static inline uintptr_t ringLogArg(int v) { return (uintptr_t)v; }
+static inline uintptr_t ringLogArg(unsigned v) { return v; }
+static inline uintptr_t ringLogArg(long v) { return (uintptr_t)v; }
+static inline uintptr_t ringLogArg(unsigned long v) { return v; }
+static inline uintptr_t ringLogArg(const char *s) { return (uintptr_t)s; }
+
+template <typename... Args>
+void ringLog(const char *fmt, Args... args)
+{
+  static_assert(sizeof...(Args) <= RING_LOG_ARGS, "too many arguments for ringLog");
+
+  uint32_t pos = ringLogHead.load(std::memory_order_relaxed);
+  RingLogEntry *e;
+  while (true)
+  {
+    e = &ringLogEntries[pos % RING_LOG_ENTRIES];
+    int32_t turn = (int32_t)(e->seq.load(std::memory_order_acquire) - pos);
+    if (turn == 0 && ringLogHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      break;
+    if (turn < 0)
+    {
+      ringLogDropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    if (turn > 0)
+      pos = ringLogHead.load(std::memory_order_relaxed);
+  }
+
+  uintptr_t values[RING_LOG_ARGS] = {ringLogArg(args)...};
+  e->fmt = fmt;
+  e->ms = (uint32_t)(esp_timer_get_time() / 1000);
+  memcpy(e->args, values, sizeof(values));
+  e->seq.store(pos + 1, std::memory_order_release);
+}
+
+static void ringLogKeep(const char *text, int len)
+{
+  xSemaphoreTake(ringLogTextLock, portMAX_DELAY);
+  for (int i = 0; i < len; i++)
+  {
+    ringLogText[ringLogTextEnd++ % RING_LOG_TAIL] = text[i];
+  }
+  xSemaphoreGive(ringLogTextLock);
+}
+
+// Format and print everything queued so far
+void ringLogFlush()
+{
+  uint32_t dropped = ringLogDropped.exchange(0, std::memory_order_relaxed);
+  char line[160];
+  if (dropped)
+  {
+    int len = snprintf(line, sizeof(line), "(log) %lu entries dropped\n", (unsigned long)dropped);
+    fputs(line, stdout);
+    ringLogKeep(line, len);
+  }
+
+  while (true)
+  {
+    RingLogEntry &e = ringLogEntries[ringLogTail % RING_LOG_ENTRIES];
+    if (e.seq.load(std::memory_order_acquire) != ringLogTail + 1)
+      break;
+
+    const uintptr_t *a = e.args;
+    int len = snprintf(line, sizeof(line), "(%lu) ", (unsigned long)e.ms);
+    len += snprintf(line + len, sizeof(line) - len, e.fmt, a[0], a[1], a[2], a[3], a[4], a[5]);
+    if (len >= (int)sizeof(line))
+      len = sizeof(line) - 1;
+    e.seq.store(ringLogTail + RING_LOG_ENTRIES, std::memory_order_release);
+    ringLogTail++;
+
+    fputs(line, stdout);
+    ringLogKeep(line, len);
+  }
+}
+
+static void ringLogTaskMain(void *)
+{
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(RING_LOG_PERIOD_MS));
+    ringLogFlush();
+  }
+}
+
+void ringLogStart()
+{
+  for (uint32_t i = 0; i < RING_LOG_ENTRIES; i++)
+  {
+    ringLogEntries[i].seq.store(i, std::memory_order_relaxed);
+  }
+  ringLogTextLock = xSemaphoreCreateMutex();
+  xTaskCreate(ringLogTaskMain, "log", 3072, nullptr, 1, &ringLogTask);
+}
+
+// Copy out the kept text, oldest first. Returns its length.
+size_t ringLogCopy(char *out, size_t size)
+{
+  xSemaphoreTake(ringLogTextLock, portMAX_DELAY);
+  uint32_t kept = ringLogTextEnd < RING_LOG_TAIL ? ringLogTextEnd : RING_LOG_TAIL;
+  size_t n = kept < size ? kept : size;
+  for (size_t i = 0; i < n; i++)
+  {
+    out[i] = ringLogText[(ringLogTextEnd - n + i) % RING_LOG_TAIL];
+  }
+  xSemaphoreGive(ringLogTextLock);
+  return n;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <time.h>
+
+#include <ArduinoJson.h>
+
+#include "cache.h"
+#include "calendar.h"
+#include "events.h"
+
+// The config fetched from the server, validated once and kept in NVS in
+// binary form, so boot can apply the last good one without network or JSON.
+// Bump SETTINGS_VERSION whenever Settings changes; older records are ignored.
+
+#define SETTINGS_VERSION 4
+#define SETTINGS_KEY "settings"
+#define SETTINGS_EVENTS_KEY "settings.events"
+// Leaves the small NVS partition room for everything else; later events come with the next fetch
+#define SETTINGS_EVENTS_SIZE 3072
+// Feeds are fetched at the same time, each holds a TLS session in internal RAM
+#define SETTINGS_MAX_CALENDARS 3
+
+struct Settings
+{
+  uint16_t version;
+  uint16_t size;
+  char tz[64];
+  bool hasTimeOverride;
+  int64_t timeOverride;
+  bool accelReverse;
+  uint8_t accelDim;
+  int32_t accelThreshold;
+  int32_t buzzerScale;
+  int32_t motionUpdatePeriod;
+  int32_t inactivityPeriod;
+  int32_t lineSpacing;
+  CalendarSource calendars[SETTINGS_MAX_CALENDARS]; // ICS feeds
+  int32_t calendarDays; // How far ahead recurrences are expanded
+};
+
+// Fill s and a new events store from the server's JSON, false if anything is missing or out of range
+bool settingsFromJson(JsonDocument &doc, Settings &s, EventStore *&events)
+{
+  events = nullptr;
+
+  s = {};
+  s.version = SETTINGS_VERSION;
+  s.size = sizeof(Settings);
+
+  const char *tz = doc["tz"].as<const char *>();
+  if (tz == nullptr || strlen(tz) >= sizeof(s.tz))
+    return false;
+  strcpy(s.tz, tz);
+
+  s.hasTimeOverride = !doc["timeOverride"].isNull();
+  s.timeOverride = doc["timeOverride"].as<int64_t>();
+
+  const char *dim = doc["accelDim"].as<const char *>();
+  if (dim == nullptr || (dim[0] != '-' && dim[0] != '+') || dim[1] < '0' || dim[1] > '2')
+    return false;
+  s.accelReverse = dim[0] == '-';
+  s.accelDim = dim[1] - '0';
+
+  s.accelThreshold = doc["accelThreshold"].as<int>();
+  s.buzzerScale = doc["buzzerScale"].as<int>();
+  s.motionUpdatePeriod = doc["motionUpdatePeriod"].as<int>();
+  s.inactivityPeriod = doc["inactivityPeriod"].as<int>();
+  s.lineSpacing = doc["lineSpacing"].as<int>();
+  if (s.accelThreshold <= 0 || s.motionUpdatePeriod <= 0 || s.inactivityPeriod < 0 || s.lineSpacing <= 0)
+    return false;
+
+  int calendars = 0;
+  for (JsonVariantConst feed : doc["calendars"].as<JsonArrayConst>())
+  {
+    const char *host = feed["host"] | "";
+    const char *path = feed["path"] | "/";
+    if (calendars == SETTINGS_MAX_CALENDARS || host[0] == 0 || strlen(host) >= sizeof(CalendarSource::host) || strlen(path) >= sizeof(CalendarSource::path))
+      return false;
+    strcpy(s.calendars[calendars].host, host);
+    strcpy(s.calendars[calendars].path, path);
+    calendars++;
+  }
+  s.calendarDays = doc["calendarDays"] | 14;
+  if (s.calendarDays <= 0 || s.calendarDays > 366)
+    return false;
+
+  // Sized exactly: one pass to measure, one to fill
+  JsonArrayConst list = doc["events"].as<JsonArrayConst>();
+  uint32_t count = 0, stringBytes = 0;
+  for (JsonVariantConst item : list)
+  {
+    const char *title = item.is<const char *>() ? item.as<const char *>() : item["title"].as<const char *>();
+    const char *location = item["location"].as<const char *>();
+    count++;
+    stringBytes += (title ? strlen(title) + 1 : 0) + (location ? strlen(location) + 1 : 0);
+  }
+
+  events = eventStoreCreate(count, stringBytes);
+  if (events == nullptr)
+    return false;
+
+  // Plain strings are untimed, objects carry start and end in Unix seconds
+  for (JsonVariantConst item : list)
+  {
+    if (item.is<const char *>())
+    {
+      eventStoreAdd(events, EVENT_UNTIMED, EVENT_UNTIMED, item.as<const char *>());
+    }
+    else if (item["start"].as<int64_t>() > EVENT_UNTIMED)
+    {
+      const char *title = item["title"] | "";
+      const char *location = item["location"] | "";
+      eventStoreAdd(events, item["start"].as<int64_t>(), item["end"].as<int64_t>(), title, location);
+    }
+  }
+  eventStoreFinish(events);
+
+  return true;
+}
+
+// Events are saved as a compacted store: the untimed ones and those not over yet, as many as fit
+void settingsSave(const Settings &s, const EventStore *events)
+{
+  EventStore *saved = eventStoreCompact(events, eventStoreNext(events, time(NULL) - events->maxDuration), SETTINGS_EVENTS_SIZE);
+
+  esp_err_t err = cacheSave(SETTINGS_KEY, &s, sizeof(s));
+  if (err == ESP_OK)
+    err = saved ? cacheSave(SETTINGS_EVENTS_KEY, saved, saved->size) : cacheSave(SETTINGS_EVENTS_KEY, "", 0);
+  if (err != ESP_OK)
+    printf("Failed saving settings\n");
+
+  free(saved);
+}
+
+// The last saved settings, false if there are none of this version. events may come back empty.
+bool settingsLoad(Settings &s, EventStore *&events)
+{
+  events = nullptr;
+
+  if (!cacheLoad(SETTINGS_KEY, &s, sizeof(s)) || s.version != SETTINGS_VERSION || s.size != sizeof(Settings))
+    return false;
+
+  s.tz[sizeof(s.tz) - 1] = 0;
+  for (CalendarSource &feed : s.calendars)
+  {
+    feed.host[sizeof(feed.host) - 1] = 0;
+    feed.path[sizeof(feed.path) - 1] = 0;
+  }
+
+  alignas(EventStore) static uint8_t blob[SETTINGS_EVENTS_SIZE];
+  size_t len = cacheLoadAny(SETTINGS_EVENTS_KEY, blob, sizeof(blob));
+  if (eventStoreValid((const EventStore *)blob, len))
+  {
+    events = (EventStore *)malloc(len);
+    if (events)
+      memcpy(events, blob, len);
+  }
+
+  return true;
+}
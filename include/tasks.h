@@ -0,0 +1,100 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <esp_timer.h>
+
+#include "gesture.h"
+
+// Commands passed between the render, sensor and network tasks.
+// Only the render task touches LVGL; everyone else posts to uiQueue.
+
+enum UiCommandType : uint8_t
+{
+  UI_SHIFT,         // value: new pixel shift
+  UI_GESTURE,       // value: Gesture
+  UI_EVENTS_LOADED, // payload: malloc'd EventStore, render task takes ownership
+  UI_BATCH,         // payload: malloc'd UiBatch, render task takes ownership
+};
+
+struct UiCommand
+{
+  UiCommandType type;
+  int32_t value;
+  void *payload;
+  int64_t postedUs;
+};
+
+// Commands applied together in one render pass
+struct UiBatch
+{
+  uint32_t count;
+  UiCommand commands[];
+};
+
+enum NetCommandType : uint8_t
+{
+  NET_RELOAD, // Fetch and apply the config again
+};
+
+struct NetCommand
+{
+  NetCommandType type;
+  int64_t postedUs;
+};
+
+QueueHandle_t uiQueue = nullptr;
+QueueHandle_t netQueue = nullptr;
+
+struct LatencyStat
+{
+  uint32_t count;
+  int64_t totalUs;
+  int64_t maxUs;
+};
+
+// Sensor sample to the end of the panel refresh that shows it
+LatencyStat gestureLatency = {};
+// httpd handler entry to response sent
+LatencyStat httpLatency = {};
+
+void latencyRecord(LatencyStat &stat, int64_t us)
+{
+  stat.count++;
+  stat.totalUs += us;
+  if (us > stat.maxUs)
+    stat.maxUs = us;
+}
+
+int latencyAverage(const LatencyStat &stat)
+{
+  return stat.count ? (int)(stat.totalUs / stat.count) : 0;
+}
+
+void tasksInit()
+{
+  uiQueue = xQueueCreate(16, sizeof(UiCommand));
+  netQueue = xQueueCreate(4, sizeof(NetCommand));
+}
+
+// Never blocks; a full queue drops the command
+bool postUi(UiCommandType type, int32_t value = 0, void *payload = nullptr, int64_t postedUs = esp_timer_get_time())
+{
+  UiCommand cmd = {type, value, payload, postedUs};
+  return xQueueSend(uiQueue, &cmd, 0) == pdTRUE;
+}
+
+// Never blocks; the batch is freed if the queue is full
+bool postUiBatch(UiBatch *batch)
+{
+  if (postUi(UI_BATCH, batch->count, batch))
+    return true;
+  free(batch);
+  return false;
+}
+
+bool postNet(NetCommandType type)
+{
+  NetCommand cmd = {type, esp_timer_get_time()};
+  return xQueueSend(netQueue, &cmd, 0) == pdTRUE;
+}
@@ -7,8 +7,15 @@
 
 #include "../env.h"
 #include "log.h"
+#include "tasks.h"
 #include "http.h"
 #include "display.h"
+#include "settings.h"
+#include "ics.h"
+#include "event_list.h"
+#include "mpu_fifo.h"
+#include "motion_sim.h"
+#include "bench.h"
 
 #include <Adafruit_MPU6050.h>
 
@@ -20,17 +27,14 @@ static void lv_tick_task(void *arg)
 }
 
 lv_display_t *drv = nullptr;
-QueueHandle_t xGuiSemaphore = nullptr;
 
-std::vector<std::string> events;
+// Owned by the render task, replaced whole on reload
+EventStore *events = nullptr;
 int eventsCursor = 0;
 
 bool accelReverse = false;
 int accelDim = 0;
 int accelThreshold = 5;
-int baseHorizAccel = -999;
-int baseForwardAccel = -999;
-int acted = 0;
 int inactivityPeriod = 2;
 
 int buzzerScale = 1;
@@ -38,53 +42,136 @@ int buzzerScale = 1;
 int motionUpdatePeriod = 500;
 int lineSpacing = 10;
 
-int getHorizAccel(sensors_vec_t accel)
-{
-  return -int(accel.z);
+// Last applied config, only touched by the network task once it runs
+Settings settings = {};
+// Event sources, owned by the network task; the render task gets merged copies
+EventStore *configEvents = nullptr;
+EventStore *calendarEvents[SETTINGS_MAX_CALENDARS] = {};
+
+// Calendar events that started this long ago are still fetched, they may not be over
+#define CALENDAR_LOOKBEHIND_S (24 * 3600)
+// An unchanged feed is expanded again after this long, for the window to move on
+#define CALENDAR_REEXPAND_S (6 * 3600)
+// Where the config is fetched from
+#define SETTINGS_HOST "karrmedia.com"
+#define SETTINGS_PATH "/iot/cal/config.json"
+// 2020-01-01, anything earlier is the clock before SNTP
+#define CLOCK_VALID_AFTER 1577836800
+
+EventList eventList = {};
+
+void drawEvents() {
+  eventListBind(eventList, events, eventsCursor, time(NULL));
 }
 
-int getForwardAccel(sensors_vec_t accel)
+// Fills in the FIFO between bursts while the watch is moving
+#define MPU_BURST_MS 50
+// How long a motion interrupt keeps the bursts going
+#define MPU_ACTIVE_US 1000000
+
+// Flicks below this are dropped
+#define GESTURE_MIN_CONFIDENCE 50
+// Print every sample as a trace line, for replaying through gesture.h on a PC
+#define GESTURE_TRACE 0
+
+// Set to feed the recognizer from a script instead of the MPU6050, see motion_sim.h
+#ifndef SENSOR_SIM
+#define SENSOR_SIM 0
+#endif
+#define SENSOR_SIM_SCRIPT "F1500 F1500 B1500 L3000 R3000"
+
+// The recognizer's config from the current settings
+static GestureConfig gestureConfig()
 {
-  return int(accel.x);
+  GestureConfig config = {};
+  // accelThreshold is in m/s^2
+  config.threshold = accelThreshold * MPU_LSB_PER_G * 100 / 981;
+  config.refractoryUs = (int64_t)inactivityPeriod * motionUpdatePeriod * 1000;
+  config.minConfidence = GESTURE_MIN_CONFIDENCE;
+  return config;
 }
 
-lv_obj_t* rows[7] = {};
-void drawEvents() {
-  static std::string buf;
+// Drains the MPU6050's FIFO in bursts and turns flicks into gesture commands
+// for the render task. While still it only wakes on the motion interrupt, or
+// every motionUpdatePeriod to keep the FIFO from overflowing.
+void sensorTask(void *)
+{
+#if SENSOR_SIM
+  static MotionSim sim;
+  motionSimInit(sim, SENSOR_SIM_SCRIPT, esp_timer_get_time());
+#else
+  TwoWire wire(1);
+  wire.begin(MPU_SDA, MPU_SCL, 400000);
 
+  Adafruit_MPU6050 mpu;
+  CHECK(mpu.begin(MPU6050_I2CADDR_DEFAULT, &wire, 0));
+  mpu.setAccelerometerRange(MPU6050_RANGE_8_G);
+  CHECK(mpuFifoInit(wire));
+  mpuFifoStart();
+#endif
 
+  static MotionSample batch[MPU_BATCH_MAX];
+  static GestureRecognizer recognizer;
+  gestureInit(recognizer, gestureConfig());
+  int64_t activeUntil = 0;
 
-  for (int i = 0; i < 7; i++) {
-    if (i + eventsCursor >= events.size()) {
-      lv_label_set_text(rows[i], "");
-    }
-    else {
-      //lv_label_set_text(rows[i], events[eventsCursor + i].c_str());
-      //buf.append(events[eventsCursor + i]);
+  while (true)
+  {
+    bool moving = esp_timer_get_time() < activeUntil;
+    int idleMs = motionUpdatePeriod < MPU_FIFO_MS ? motionUpdatePeriod : MPU_FIFO_MS;
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(moving ? MPU_BURST_MS : idleMs)))
+    {
+      motionStats.wakeups++;
+      activeUntil = esp_timer_get_time() + MPU_ACTIVE_US;
     }
 
-    //buf.push_back('\n');
-  }
+    // Settings may have changed under us, the baseline carries on
+    recognizer.config = gestureConfig();
+
+    int n;
+    do
+    {
+#if SENSOR_SIM
+      n = motionSimDrain(sim, batch, MPU_BATCH_MAX, esp_timer_get_time());
+#else
+      n = mpuFifoDrain(wire, batch, MPU_BATCH_MAX);
+#endif
+      for (int i = 0; i < n; i++)
+      {
+        if (GESTURE_TRACE)
+        {
+          char line[64];
+          gestureTraceFormat(batch[i], line, sizeof(line));
+          fputs(line, stdout);
+        }
 
-  lv_label_set_text(rows[0], "11:30-12:45pm CE3320 Digital Circuits\n"
-"1-3:45pm CE3201 Fundamentals Lab\n"
-"5pm Assignment-3\n"
-"5:30-6:45pm CE2301 ENA\n"
-"8-9pm Council Meeting\n"
-"11:59pm Lab 4 (Oral Report)");
+        GestureResult result = gestureFeed(recognizer, batch[i]);
+        if (result.gesture != GESTURE_NONE)
+        {
+          ringLog("Gesture %d, %d%% confident\n", (int)result.gesture, (int)result.confidence);
+          postUi(UI_GESTURE, result.gesture, nullptr, result.us);
+        }
+      }
+    } while (n == MPU_BATCH_MAX);
+  }
 }
 
-extern "C" void app_main()
+// Start SNTP unless the config sets the time. Network task only, once WiFi
+// is up: esp_netif is not initialised before that.
+void startSntp()
 {
-  for (int i = 0; i < 3; i++)
-  {
-    printf("Hello!\n");
-    vTaskDelay(1000);
-  }
+  static bool sntpStarted = false;
+  if (sntpStarted || settings.hasTimeOverride)
+    return;
 
-  initArduino();
+  esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG("pool.ntp.org");
+  esp_netif_sntp_init(&config);
+  sntpStarted = true;
+}
 
-  WiFi.begin(SSID, PASSWORD);
+// Runs network work so the httpd task never waits on a fetch
+void networkTask(void *)
+{
   printf("\nConnecting");
 
   while (WiFi.status() != WL_CONNECTED)
@@ -92,43 +179,50 @@ extern "C" void app_main()
     printf(".\n");
     delay(1000);
   }
+  startSntp();
 
-  loadConfig();
-
-  start_webserver();
-
-  TwoWire wire(1);
-  wire.begin(12, 11, 100000);
-
-  Adafruit_MPU6050 mpu;
-  CHECK(mpu.begin(MPU6050_I2CADDR_DEFAULT, &wire, 0));
-  mpu.setAccelerometerRange(MPU6050_RANGE_8_G);
-
-  xGuiSemaphore = xSemaphoreCreateMutex();
-
-  SPI.begin(/*SCK*/ 39, /*MISO*/ -1, /*MOSI*/ 37, /*SS*/ -1);
-  auto set = SPISettings(2000000, MSBFIRST, SPI_MODE0);
-
-  pinMode(DISPLAY_POWER, OUTPUT);
-  digitalWrite(DISPLAY_POWER, 1);
+  while (true)
+  {
+    NetCommand cmd;
+    if (xQueueReceive(netQueue, &cmd, portMAX_DELAY) != pdTRUE)
+      continue;
 
-  display.init(115200, true, 50, false, SPI, set);
-  display.setRotation(1);
-  display.setFullWindow();
-  display.firstPage();
+    switch (cmd.type)
+    {
+    case NET_RELOAD:
+    {
+      bool changed = loadConfig();
+      startSntp();
+      changed |= loadCalendar();
+      if (changed)
+        publishEvents();
+
+      HttpStats stats = httpStatsGet();
+      printf("Reload done %d ms after request, %d requests, %d handshakes (%d ms), last first byte after %d ms, %d not modified, %d body bytes\n",
+             (int)((esp_timer_get_time() - cmd.postedUs) / 1000), (int)stats.requests, (int)stats.handshakes,
+             (int)(stats.handshakeUs / 1000), (int)(stats.lastTtfbUs / 1000), (int)stats.notModified, (int)stats.bodyBytes);
+      break;
+    }
+    }
+  }
+}
 
+// Owns LVGL: builds the UI, then applies commands and renders
+void renderTask(void *)
+{
   lv_init();
 
   drv = lv_display_create(296, 128);
 
   lv_display_set_flush_cb(drv, flush_cb);
+  lv_display_set_color_format(drv, LV_COLOR_FORMAT_I1);
+  lv_display_add_event_cb(drv, rounder_cb, LV_EVENT_INVALIDATE_AREA, NULL);
 
-#define DRAW_BUF_SIZE (DISP_BUF_SIZE * lv_color_format_get_size(lv_display_get_color_format(drv)))
-  lv_color_t *draw_buf = (lv_color_t *)malloc(DRAW_BUF_SIZE);
+  uint8_t *draw_buf = (uint8_t *)malloc(DISP_BUF_SIZE);
 
   CHECK(draw_buf != NULL);
 
-  lv_display_set_buffers(drv, draw_buf, NULL, DRAW_BUF_SIZE, LV_DISPLAY_RENDER_MODE_PARTIAL);
+  lv_display_set_buffers(drv, draw_buf, NULL, DISP_BUF_SIZE, LV_DISPLAY_RENDER_MODE_PARTIAL);
 
   lv_display_set_dpi(drv, 108);
 
@@ -157,13 +251,8 @@ extern "C" void app_main()
   lv_bar_set_value(bar, 0, LV_ANIM_ON);
 
   // Calendar items
-  for (int i = 0; i < 1; i++) {
-    rows[i] = lv_label_create(tile0);
-    lv_obj_set_pos(rows[i], 0, 10 + i * 10);
-    char buf[50] = {};
-    snprintf(buf, sizeof(buf), "Long Long Long Long Test Item %d", i);
-    lv_label_set_text(rows[i], buf);
-  }
+  eventListCreate(eventList, tile0);
+  eventListLayout(eventList, lineSpacing, 128);
   drawEvents();
 
   // Right 1: Image
@@ -180,168 +269,396 @@ extern "C" void app_main()
   lv_image_set_src(image2, &img2);
   lv_obj_align(image2, LV_ALIGN_CENTER, 0, 0);
 
-  static unsigned long lastMotionUpdate = 0;
+  // LVGL's refresh timer would wake us every LV_DEF_REFR_PERIOD. It only runs while an
+  // animation does; everything else is rendered right after it changes.
+  lv_timer_t *refrTimer = lv_display_get_refr_timer(drv);
+
+  char shownClock[30] = {};
+  int shownBar = -1;
+  int shownLineSpacing = -1;
+  uint32_t wakeups = 0;
+  TickType_t wait = 0;
 
   while (true)
   {
-    vTaskDelay(100);
+    bool changed = false;
 
-    /* Try to take the semaphore, call lvgl related function on success */
-    if (pdTRUE == xSemaphoreTake(xGuiSemaphore, portMAX_DELAY))
+    auto apply = [&](const UiCommand &cmd)
     {
-      char buf[30];
-      time_t now = time(NULL);
-      // strftime(buf, 20, "%Y-%m-%d %H:%M:%S", localtime(&now));
-      strftime(buf, 20, "%H:%M %a, %b %d", localtime(&now));
-      lv_label_set_text(clock, buf);
-
-      lv_bar_set_value(bar, now % 60, LV_ANIM_ON);
-
-      if (now % 60 == 0 && lv_tileview_get_tile_active(tileView) == tile0)
+      switch (cmd.type)
       {
-        // Reminder flash
-        display.clearScreen();
-        display.display(false);
-      }
+      case UI_SHIFT:
+        pixelShift = cmd.value;
+        ringLog("Updated shift to %d\n", (int)cmd.value);
+        break;
 
-      // Only do motion analysis once a second and skip it after it happens
-      if (millis() - lastMotionUpdate >= motionUpdatePeriod)
+      case UI_EVENTS_LOADED:
       {
-        lastMotionUpdate = millis();
+        // Nothing else holds the old store, drawEvents() only runs here
+        free(events);
+        events = (EventStore *)cmd.payload;
+        eventsCursor = 0;
+        drawEvents();
+        break;
+      }
 
-        if (acted < inactivityPeriod)
+      case UI_GESTURE:
+        // No animations: on e-paper every animation frame is another refresh
+        switch (cmd.value)
         {
-          acted += 1;
+        case GESTURE_LEFT:
+          currentCol = (currentCol == 0) ? 0 : currentCol - 1;
+          lv_tileview_set_tile_by_index(tileView, currentCol, currentRow, LV_ANIM_OFF);
+          break;
+        case GESTURE_RIGHT:
+          currentCol = (currentCol == 2) ? 2 : currentCol + 1;
+          lv_tileview_set_tile_by_index(tileView, currentCol, currentRow, LV_ANIM_OFF);
+          break;
+        case GESTURE_FORWARD:
+          currentCol = (currentCol == 0) ? 0 : currentCol - 1;
+          eventsCursor = (eventsCursor + 3 < (int)eventListRange(events, time(NULL)).length) ? (eventsCursor + 3) : eventsCursor;
+          drawEvents();
+          break;
+        case GESTURE_BACK:
+          currentCol = (currentCol == 2) ? 2 : currentCol + 1;
+          eventsCursor = (eventsCursor >= 3) ? (eventsCursor - 3) : 0;
+          drawEvents();
+          break;
         }
-        else
-        {
 
-          sensors_event_t a, g, temp;
-          mpu.getEvent(&a, &g, &temp);
-
-          /* Print out the values */
-          printf("Acceleration %f %f %f\n", a.acceleration.x, a.acceleration.y, a.acceleration.z);
-          printf("Rotation %f %f %f\n", g.gyro.x, g.gyro.y, g.gyro.z);
-          printf("Temperature %f\n", temp.temperature);
-
-          int val = getHorizAccel(a.acceleration);
-          if (baseHorizAccel == -999)
-          {
-            baseHorizAccel = val;
-          }
-          else
-          {
-            if (val - baseHorizAccel > accelThreshold)
-            {
-              // Turn left
-              printf("TURN LEFT\n");
-              currentCol = (currentCol == 0) ? 0 : currentCol - 1;
-              lv_tileview_set_tile_by_index(tileView, currentCol, currentRow, LV_ANIM_ON);
-
-              acted = 0;
-            }
-            else if (val - baseHorizAccel < -accelThreshold)
-            {
-              // Turn right
-              printf("TURN RIGHT\n");
-              currentCol = (currentCol == 2) ? 2 : currentCol + 1;
-              lv_tileview_set_tile_by_index(tileView, currentCol, currentRow, LV_ANIM_ON);
-
-              acted = 0;
-            }
-          }
-
-          val = getForwardAccel(a.acceleration);
-          if (baseForwardAccel == -999)
-          {
-            baseForwardAccel = val;
-          }
-          else
-          {
-            if (val - baseForwardAccel > accelThreshold)
-            {
-              printf("Tilt forward\n");
-              currentCol = (currentCol == 0) ? 0 : currentCol - 1;
-
-              eventsCursor = (eventsCursor + 3 < events.size()) ? (eventsCursor + 3) : events.size() + 3;
-              //drawEvents();
-              lv_obj_set_y(rows[0], eventsCursor * 10);
-
-              acted = 0;
-            }
-            else if (val - baseForwardAccel < -accelThreshold)
-            {
-              printf("Tilt backward\n");
-              currentCol = (currentCol == 2) ? 2 : currentCol + 1;
-
-              eventsCursor = (eventsCursor >= 3) ? (eventsCursor - 3) : 0;
-              lv_obj_set_y(rows[0], eventsCursor * 10);
-              //drawEvents();
-
-              acted = 0;
-            }
-          }
-        }
+        panelGestureApplied(cmd.postedUs);
+        break;
+
+      case UI_BATCH:
+        break;
       }
+    };
 
-      for (int i = 0; i < 4; i++) {
-        lv_obj_set_pos(rows[i], 0, lineSpacing + i * lineSpacing);
+    UiCommand cmd;
+    while (xQueueReceive(uiQueue, &cmd, wait) == pdTRUE)
+    {
+      wait = 0;
+      changed = true;
+
+      if (cmd.type == UI_BATCH)
+      {
+        // Everything in it lands in this pass, so the panel refreshes once for all of it
+        UiBatch *batch = (UiBatch *)cmd.payload;
+        for (uint32_t i = 0; i < batch->count; i++)
+        {
+          apply(batch->commands[i]);
+        }
+        free(batch);
+      }
+      else
+      {
+        apply(cmd);
       }
+    }
+
+    wakeups++;
+
+    // Only touch widgets whose shown value changes
+    char buf[30];
+    time_t now = time(NULL);
+    // strftime(buf, 20, "%Y-%m-%d %H:%M:%S", localtime(&now));
+    strftime(buf, 20, "%H:%M %a, %b %d", localtime(&now));
+    if (strcmp(buf, shownClock) != 0)
+    {
+      strcpy(shownClock, buf);
+      lv_label_set_text(clock, buf);
+      // Drop events that just ended
+      drawEvents();
+      changed = true;
+
+      const RefreshStats &st = refreshScheduler.stats;
+      ringLog("%d render wakeups, %d panel refreshes last minute\n", (int)wakeups, (int)st.lastMinute);
+      wakeups = 0;
+    }
+
+    if (now % 60 != shownBar)
+    {
+      shownBar = now % 60;
+      lv_bar_set_value(bar, shownBar, LV_ANIM_OFF);
+      changed = true;
+    }
 
-      lv_task_handler();
-      xSemaphoreGive(xGuiSemaphore);
+    if (lineSpacing != shownLineSpacing)
+    {
+      shownLineSpacing = lineSpacing;
+      eventListLayout(eventList, lineSpacing, 128);
+      drawEvents();
+      changed = true;
     }
+
+    if (changed)
+      lv_refr_now(drv);
+
+    if (lv_anim_count_running())
+      lv_timer_resume(refrTimer);
+    else
+      lv_timer_pause(refrTimer);
+
+    uint32_t lvglStart = metricsNow();
+    uint32_t next = lv_timer_handler();
+    metricsRecord(SPAN_LVGL, metricsNow() - lvglStart);
+
+    panelGesturesRendered();
+
+    // Sleep until LVGL's next timer or the next second, a command wakes us earlier
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint32_t toNextSecond = 1000 - tv.tv_usec / 1000;
+    wait = pdMS_TO_TICKS(next < toNextSecond ? next : toNextSecond);
   }
 }
 
-void op(int shift, const char *text)
+extern "C" void app_main()
 {
-  xSemaphoreTake(xGuiSemaphore, portMAX_DELAY);
+  initArduino();
+  ringLogStart();
+
+#if BENCH
+  if (benchRun(benchNvs))
+    printf("Benchmarks regressed against this board's baseline\n");
+#endif
+
+  tasksInit();
+  httpInit();
 
-  pixelShift = shift;
+  // Usable right away; the network task refreshes it once WiFi is up
+  loadSavedConfig();
+
+  WiFi.begin(SSID, PASSWORD);
+  start_webserver();
+  postNet(NET_RELOAD);
+
+  // WiFi, SNTP and the fetch run while the panel comes up
+  xTaskCreate(networkTask, "network", 8192, nullptr, 2, nullptr);
+  xTaskCreate(sensorTask, "sensor", 4096, nullptr, 3, nullptr);
+
+  SPI.begin(DISPLAY_SCK, /*MISO*/ -1, DISPLAY_MOSI, /*SS*/ -1);
+  auto set = SPISettings(PANEL_SPI_HZ, MSBFIRST, SPI_MODE0);
+
+  pinMode(DISPLAY_POWER, OUTPUT);
+  digitalWrite(DISPLAY_POWER, 1);
+
+  display.init(115200, true, 50, false, SPI, set);
+  display.setRotation(1);
+  display.setFullWindow();
+  display.firstPage();
+  displayStart();
 
-  printf("Updated shift to %d\n", shift);
+  if (panelRestore())
+    printf("Restored the last frame, first pixel %d ms after boot\n", (int)(panelFirstPixelUs / 1000));
 
-  xSemaphoreGive(xGuiSemaphore);
+  xTaskCreate(renderTask, "render", 8192, nullptr, 4, nullptr);
 }
 
-void loadConfig()
+// Apply a validated config. SNTP is left to startSntp().
+void applySettings(const Settings &s)
 {
-  static JsonDocument doc;
-  getJsonFromPath("karrmedia.com", "/iot/cal/config.json", doc);
-
-  setenv("TZ", doc["tz"].as<const char *>(), 1);
+  setenv("TZ", s.tz, 1);
   tzset();
 
-  if (doc["timeOverride"].isNull())
-  {
-    esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG("pool.ntp.org");
-    esp_netif_sntp_init(&config);
-  }
-  else
+  if (s.hasTimeOverride)
   {
     struct timeval tv;
-    tv.tv_sec = doc["timeOverride"].as<time_t>();
+    tv.tv_sec = s.timeOverride;
     tv.tv_usec = 0;
 
     settimeofday(&tv, NULL);
   }
 
-  accelReverse = doc["accelDim"].as<const char *>()[0] == '-';
-  accelDim = doc["accelDim"].as<const char *>()[1] - '0';
-  accelThreshold = doc["accelThreshold"].as<int>();
-  baseHorizAccel = -999;
+  accelReverse = s.accelReverse;
+  accelDim = s.accelDim;
+  accelThreshold = s.accelThreshold;
+
+  buzzerScale = s.buzzerScale;
+
+  motionUpdatePeriod = s.motionUpdatePeriod;
+  inactivityPeriod = s.inactivityPeriod;
+  lineSpacing = s.lineSpacing;
+}
+
+// Hand the render task its own copy of every event source combined
+void publishEvents()
+{
+  const EventStore *sources[1 + SETTINGS_MAX_CALENDARS] = {configEvents};
+  for (int i = 0; i < SETTINGS_MAX_CALENDARS; i++)
+  {
+    sources[1 + i] = calendarEvents[i];
+  }
+
+  EventStore *merged = eventStoreMerge(sources, 1 + SETTINGS_MAX_CALENDARS);
+  if (merged && !postUi(UI_EVENTS_LOADED, 0, merged))
+  {
+    free(merged);
+  }
+}
+
+// Report once how long the first up to date config took
+void bootFreshData()
+{
+  static bool reported = false;
+  if (reported)
+    return;
+  reported = true;
+
+  printf("Boot: first pixel after %d ms, fresh data after %d ms\n",
+         (int)(panelFirstPixelUs / 1000), (int)(esp_timer_get_time() / 1000));
+}
+
+// The config saved by the last successful fetch, applied before the network is up
+void loadSavedConfig()
+{
+  int64_t start = esp_timer_get_time();
+
+  if (!settingsLoad(settings, configEvents))
+  {
+    printf("No saved config\n");
+    return;
+  }
+
+  applySettings(settings);
+  publishEvents();
+  printf("Applied saved config with %d events in %d us\n", configEvents ? (int)configEvents->count : 0, (int)(esp_timer_get_time() - start));
+}
+
+// True if the config changed
+bool loadConfig()
+{
+  // Only the keys read by settingsFromJson are kept, the rest is skipped as it streams in
+  JsonDocument filter;
+  for (const char *key : {"tz", "timeOverride", "accelDim", "accelThreshold", "events", "buzzerScale", "motionUpdatePeriod",
+                          "inactivityPeriod", "lineSpacing", "calendars", "calendarDays"})
+  {
+    filter[key] = true;
+  }
+
+  // Once a config has been applied the server only needs to send a newer one
+  JsonDocument doc;
+  HttpValidators validators;
+  esp_err_t err = getJsonFromPath(SETTINGS_HOST, SETTINGS_PATH, doc, filter, settings.version == SETTINGS_VERSION, &validators);
+  if (err == HTTP_NOT_MODIFIED)
+  {
+    printf("Config unchanged\n");
+    bootFreshData();
+    return false;
+  }
+  if (err != ESP_OK)
+  {
+    return false;
+  }
+
+  Settings fresh;
+  EventStore *loaded;
+  if (!settingsFromJson(doc, fresh, loaded))
+  {
+    printf("Config rejected, keeping the current one\n");
+    free(loaded);
+    return false;
+  }
+
+  settingsSave(fresh, loaded);
+  // Only a config that passed is revalidated against from now on
+  httpAccept(SETTINGS_HOST, SETTINGS_PATH, validators);
+  settings = fresh;
+  applySettings(settings);
+
+  free(configEvents);
+  configEvents = loaded;
+
+  bootFreshData();
+  return true;
+}
+
+void calendarTask(void *arg)
+{
+  CalendarJob &job = *(CalendarJob *)arg;
+
+  int64_t start = esp_timer_get_time();
+  job.err = getCalendarFromPath(job.feed.host, job.feed.path, job.from, job.to, job.loaded, job.revalidate);
+  job.us = esp_timer_get_time() - start;
+
+  xSemaphoreGive(job.done);
+  vTaskDelete(nullptr);
+}
+
+// True if any calendar changed. All feeds are fetched at once, each by its own
+// task, so while one waits on the network the others parse. Recurrences are
+// expanded from now on, so an unchanged feed is still expanded again once its
+// window has moved on.
+bool loadCalendar()
+{
+  static CalendarSource fetched[SETTINGS_MAX_CALENDARS] = {};
+  static int64_t expandedAt[SETTINGS_MAX_CALENDARS] = {};
+
+  bool changed = false;
+  bool any = false;
+  for (int i = 0; i < SETTINGS_MAX_CALENDARS; i++)
+  {
+    // Forget feeds that were removed or replaced
+    if (memcmp(&fetched[i], &settings.calendars[i], sizeof(CalendarSource)) != 0 && calendarEvents[i])
+    {
+      free(calendarEvents[i]);
+      calendarEvents[i] = nullptr;
+      changed = true;
+    }
+    any |= settings.calendars[i].host[0] != 0;
+  }
+
+  if (!any)
+    return changed;
+
+  // The window is relative to now, so wait for SNTP on the first fetch after boot
+  if (time(NULL) < CLOCK_VALID_AFTER && !settings.hasTimeOverride)
+    esp_netif_sntp_sync_wait(pdMS_TO_TICKS(10000));
 
-  for (std::string item : doc["events"].as<JsonArrayConst>())
+  int64_t now = time(NULL);
+  if (now < CLOCK_VALID_AFTER)
   {
-    events.push_back(item);
+    printf("Clock not set, calendars skipped\n");
+    return changed;
   }
 
-  buzzerScale = doc["buzzerScale"].as<int>();
+  int64_t start = esp_timer_get_time();
+  SemaphoreHandle_t done = xSemaphoreCreateCounting(SETTINGS_MAX_CALENDARS, 0);
+  CalendarJob jobs[SETTINGS_MAX_CALENDARS] = {};
+  int running = 0;
 
-  motionUpdatePeriod = doc["motionUpdatePeriod"].as<int>();
-  inactivityPeriod = doc["inactivityPeriod"].as<int>();
-  lineSpacing = doc["lineSpacing"].as<int>();
+  for (int i = 0; i < SETTINGS_MAX_CALENDARS; i++)
+  {
+    CalendarJob &job = jobs[i];
+    job.err = ESP_FAIL;
+    if (settings.calendars[i].host[0] == 0)
+      continue;
+
+    job.feed = settings.calendars[i];
+    job.from = now - CALENDAR_LOOKBEHIND_S;
+    job.to = now + settings.calendarDays * 86400LL;
+    job.revalidate = calendarEvents[i] && now - expandedAt[i] < CALENDAR_REEXPAND_S;
+    job.done = done;
+
+    if (xTaskCreate(calendarTask, "calendar", 8192, &job, 2, nullptr) == pdPASS)
+      running++;
+  }
 
-  //loadCalendar();
-}
\ No newline at end of file
+  for (int i = 0; i < running; i++)
+  {
+    xSemaphoreTake(done, portMAX_DELAY);
+  }
+  vSemaphoreDelete(done);
+
+  int64_t slowest = 0, sum = 0;
+  for (const CalendarJob &job : jobs)
+  {
+    slowest = job.us > slowest ? job.us : slowest;
+    sum += job.us;
+  }
+  changed |= calendarCollect(jobs, SETTINGS_MAX_CALENDARS, calendarEvents, fetched, expandedAt, now);
+
+  printf("Fetched %d calendars in %d ms, slowest %d ms, %d ms one after another\n", running,
+         (int)((esp_timer_get_time() - start) / 1000), (int)(slowest / 1000), (int)(sum / 1000));
+  return changed;
+}